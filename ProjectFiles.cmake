@@ -2,12 +2,23 @@
 # LICENSE.md or copy at http://opensource.org/licenses/MIT
 
 # Set project source files.
-set(SRC "${SRC_PATH}/ThreadRegistry.cpp" "${SRC_PATH}/barrier.cpp" "${SRC_PATH}/TraceLog.cpp")
+set(SRC
+    "${SRC_PATH}/ThreadRegistry.cpp"
+    "${SRC_PATH}/barrier.cpp"
+    "${SRC_PATH}/TraceLog.cpp"
+    "${SRC_PATH}/DeadlockDetector.cpp"
+    "${SRC_PATH}/DeadlockDetectionService.cpp"
+    "${SRC_PATH}/DeadlockReport.cpp"
+    "${SRC_PATH}/EpochDomain.cpp"
+    "${SRC_PATH}/HazardPointerDomain.cpp"
+    "${SRC_PATH}/Rcu.cpp")
 
 set(BENCH_SRC_PATH "${SRC_PATH}/benchmark")
 set(BENCH_SRC "${BENCH_SRC_PATH}/benchMutex.cpp")
 set(BENCH2_SRC "${BENCH_SRC_PATH}/benchMutex2.cpp")
+set(DEADLOCK_BENCH_SRC "${BENCH_SRC_PATH}/benchDeadlock.cpp")
 set(FAIRTEST_SRC "${SRC_PATH}/fairnessTest.cpp")
+set(TRACE_DECODER_SRC "${SRC_PATH}/traceDecoder.cpp")
 
 # Set project benchmark files. set(BENCHMARK_SRC "${SRC_PATH}/benchmark.cpp")
 
@@ -15,4 +26,8 @@ set(FAIRTEST_SRC "${SRC_PATH}/fairnessTest.cpp")
 set(TEST_SRC
     "${TEST_SRC_PATH}/testBase.cpp"
     "${TEST_SRC_PATH}/testMutex.cpp"
-    "${TEST_SRC_PATH}/testFairMutex.cpp")
+    "${TEST_SRC_PATH}/testFairMutex.cpp"
+    "${TEST_SRC_PATH}/testDeadlockDetector.cpp"
+    "${TEST_SRC_PATH}/testThreadRegistry.cpp"
+    "${TEST_SRC_PATH}/testReclamation.cpp"
+    "${TEST_SRC_PATH}/testTraceLog.cpp")
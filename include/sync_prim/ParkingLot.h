@@ -15,6 +15,9 @@
  */
 #pragma once
 
+#include "ThreadRegistry.h"
+#include "Trace.h"
+
 #include <array>
 #include <atomic>
 #include <condition_variable>
@@ -179,8 +182,8 @@ template <typename Data = folly::Unit> class ParkingLot {
   };
 
   template <typename Key, typename Unparker>
-  WaitNode *do_unpark(parking_lot_detail::Bucket &bucket, uint64_t key,
-                      Unparker &&func);
+  WaitNode *do_unpark(parking_lot_detail::Bucket &bucket, uint64_t bits,
+                      uint64_t key, Unparker &&func);
 
   void wakeup_nodes(WaitNode *nodes);
 
@@ -272,32 +275,41 @@ ParkResult ParkingLot<Data>::park_until(
     bucket.push_back(&node);
   } // bucketLock scope
 
+  SYNC_PRIM_TRACE(trace::PARK, bits);
+
   std::forward<PreWait>(preWait)();
 
   auto status = node.wait(deadline);
 
+  // May have been woken up on another CPU.
+  ThreadRegistry::MarkCPUStale();
+
   if (status == std::cv_status::timeout) {
     // it's not really a timeout until we unlink the unsignaled node
     std::lock_guard<std::mutex> bucketLock(bucket.mutex_);
     if (!node.signaled()) {
       bucket.erase(&node);
+      SYNC_PRIM_TRACE(trace::PARK_TIMEOUT, bits);
       return ParkResult::Timeout;
     }
   }
 
+  SYNC_PRIM_TRACE(trace::UNPARKED, bits);
   return ParkResult::Unpark;
 }
 
 template <typename Data>
 template <typename Key, typename Func>
 typename ParkingLot<Data>::WaitNode *
-ParkingLot<Data>::do_unpark(parking_lot_detail::Bucket &bucket, uint64_t key,
-                            Func &&func) {
+ParkingLot<Data>::do_unpark(parking_lot_detail::Bucket &bucket, uint64_t bits,
+                            uint64_t key, Func &&func) {
   WaitNode *nodes = nullptr, *tail = nullptr;
+  uint64_t num_scanned = 0;
 
   for (auto iter = bucket.head_; iter != nullptr;) {
     auto node = static_cast<WaitNode *>(iter);
     iter = iter->next_;
+    num_scanned++;
 
     if (node->key_ == key && node->lotid_ == lotid_) {
       auto res = std::forward<Func>(func)(node->data_);
@@ -337,6 +349,9 @@ ParkingLot<Data>::do_unpark(parking_lot_detail::Bucket &bucket, uint64_t key,
     }
   }
 
+  // Nodes of other keys in the bucket are counted too, as they cost the same.
+  SYNC_PRIM_TRACE(trace::UNPARK, bits, num_scanned);
+
   return nodes;
 }
 
@@ -364,7 +379,7 @@ void ParkingLot<Data>::unpark(const Key bits, Func &&func) {
   }
 
   std::lock_guard<std::mutex> bucketLock(bucket.mutex_);
-  WaitNode *queue = do_unpark<Data>(bucket, key, func);
+  WaitNode *queue = do_unpark<Data>(bucket, uint64_t(bits), key, func);
   wakeup_nodes(queue);
 }
 
@@ -382,7 +397,7 @@ void ParkingLot<Data>::unpark(const Key bits, Preprocessor &&preprocess,
   std::forward<Preprocessor>(preprocess)();
 
   if (bucket.count_.load(std::memory_order_relaxed) != 0) {
-    nodes = do_unpark<Data>(bucket, key, func);
+    nodes = do_unpark<Data>(bucket, uint64_t(bits), key, func);
   }
 
   std::forward<Postprocessor>(postprocess)();
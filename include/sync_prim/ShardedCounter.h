@@ -0,0 +1,134 @@
+#pragma once
+
+#include "ThreadSlots.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace sync_prim {
+// Counter updated by many threads, for statistics.
+//
+// Every thread adds to its own (cache line padded) cell in a ThreadSlots, with
+// a plain load and store, so updates never bounce a shared cache line around.
+// Reading sums up all the cells, so it's the expensive side, and is only
+// approximate while threads are adding concurrently.
+//
+// Cells of exited threads are kept, so their counts are never lost, and are
+// carried on by the next thread given the same tid.
+class ShardedCounter {
+public:
+  ShardedCounter() : m_cells{&keep} {}
+  ShardedCounter(const ShardedCounter &) = delete;
+
+  void add(std::uint64_t n = 1) {
+    auto &cell = m_cells.local();
+
+    // Only the owner writes its cell.
+    cell.store(cell.load(std::memory_order_relaxed) + n,
+               std::memory_order_relaxed);
+  }
+
+  std::uint64_t load() {
+    std::uint64_t sum = 0;
+
+    m_cells.for_each_owned_ever(
+        [&](ThreadRegistry::thread_id_t, std::atomic<std::uint64_t> &cell) {
+          sum += cell.load(std::memory_order_relaxed);
+        });
+
+    return sum;
+  }
+
+private:
+  static void keep(std::atomic<std::uint64_t> &) {}
+
+  ThreadSlots<std::atomic<std::uint64_t>> m_cells;
+};
+
+// Histogram of (for eg: latency) values, recorded by many threads.
+//
+// Values are counted in power of 2 buckets: bucket 0 holds 0, and bucket `b`
+// holds the values in [2^(b-1), 2^b). Like ShardedCounter, every thread
+// records into its own cell, and `snapshot` adds up the cells.
+class ShardedHistogram {
+public:
+  static constexpr std::uint32_t NUM_BUCKETS = 65;
+
+  struct Snapshot {
+    // Returns the upper bound of the bucket holding the `p`th (0 - 100)
+    // percentile, 0 if nothing was recorded.
+    std::uint64_t percentile(double p) const {
+      auto rank = static_cast<std::uint64_t>(p / 100 * count);
+      std::uint64_t seen = 0;
+
+      for (std::uint32_t b = 0; b < NUM_BUCKETS; b++) {
+        seen += buckets[b];
+
+        if (seen > rank || (seen == count && seen != 0))
+          return upper_bound(b);
+      }
+
+      return 0;
+    }
+
+    double mean() const { return count ? static_cast<double>(sum) / count : 0; }
+
+    std::uint64_t count = 0;
+    std::uint64_t sum = 0;
+    std::array<std::uint64_t, NUM_BUCKETS> buckets{};
+  };
+
+  ShardedHistogram() : m_cells{&keep} {}
+  ShardedHistogram(const ShardedHistogram &) = delete;
+
+  void record(std::uint64_t value) {
+    Cell &cell = m_cells.local();
+
+    increment(cell.buckets[bucket(value)], 1);
+    increment(cell.sum, value);
+  }
+
+  Snapshot snapshot() {
+    Snapshot result;
+
+    m_cells.for_each_owned_ever([&](ThreadRegistry::thread_id_t, Cell &cell) {
+      for (std::uint32_t b = 0; b < NUM_BUCKETS; b++) {
+        auto count = cell.buckets[b].load(std::memory_order_relaxed);
+
+        result.buckets[b] += count;
+        result.count += count;
+      }
+
+      result.sum += cell.sum.load(std::memory_order_relaxed);
+    });
+
+    return result;
+  }
+
+  static std::uint32_t bucket(std::uint64_t value) {
+    return value == 0 ? 0 : 64 - __builtin_clzll(value);
+  }
+
+  // Largest value in bucket `b`.
+  static std::uint64_t upper_bound(std::uint32_t b) {
+    return b == 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << b) - 1;
+  }
+
+private:
+  struct Cell {
+    std::array<std::atomic<std::uint64_t>, NUM_BUCKETS> buckets{};
+    std::atomic<std::uint64_t> sum{0};
+  };
+
+  static void keep(Cell &) {}
+
+  // Only the owner writes its cell.
+  static void increment(std::atomic<std::uint64_t> &value, std::uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+  }
+
+  ThreadSlots<Cell> m_cells;
+};
+} // namespace sync_prim
@@ -2,36 +2,166 @@
 
 #include <cstdint>
 #include <limits>
+#include <type_traits>
+#include <vector>
+
+// Build time configuration (see CMakeLists.txt): width of thread ids in bits
+// (8, 16 or 32), and the max # threads registered at once. Narrower tids make
+// the lock words smaller (for eg: a 4 byte FairMutex with 16 bit tids).
+#ifndef SYNC_PRIM_TID_BITS
+#define SYNC_PRIM_TID_BITS 32
+#endif
+
+#ifndef SYNC_PRIM_MAX_THREADS
+#define SYNC_PRIM_MAX_THREADS (1 << 16)
+#endif
 
 namespace sync_prim {
 class ThreadRegistry {
 public:
-  using thread_id_t = std::uint32_t;
+  static_assert(SYNC_PRIM_TID_BITS == 8 || SYNC_PRIM_TID_BITS == 16 ||
+                    SYNC_PRIM_TID_BITS == 32,
+                "SYNC_PRIM_TID_BITS must be 8, 16 or 32");
+
+  using thread_id_t = std::conditional_t<
+      SYNC_PRIM_TID_BITS == 8, std::uint8_t,
+      std::conditional_t<SYNC_PRIM_TID_BITS == 16, std::uint16_t,
+                         std::uint32_t>>;
 
   // Invalid ThreadID
   static constexpr thread_id_t INVALID_THREADID =
       std::numeric_limits<thread_id_t>::max();
 
   // Maximum # active threads present in the system
-  static constexpr std::uint32_t MAX_THREADS = 1 << 16;
+  static constexpr std::uint32_t MAX_THREADS = SYNC_PRIM_MAX_THREADS;
+
+  // Lock words reserve the top bit of a tid for flags, and need a tid value
+  // for "unlocked", so valid tids are below 2^(SYNC_PRIM_TID_BITS - 1) - 1.
+  static_assert(MAX_THREADS > 0 && MAX_THREADS % 64 == 0,
+                "SYNC_PRIM_MAX_THREADS must be a multiple of 64");
+  static_assert(MAX_THREADS < (INVALID_THREADID >> 1),
+                "SYNC_PRIM_MAX_THREADS doesn't fit in SYNC_PRIM_TID_BITS");
+
+  // # CPUs, whose recently freed tid is cached (see SetTidRecycling).
+  static constexpr std::uint32_t MAX_TID_CACHE_CPUS = 256;
+
+  // # CurrentCPU() calls served from the cache, before it's refreshed.
+  static constexpr std::uint32_t CPU_REFRESH_INTERVAL = 128;
 
   // Register thread in ThreadRegistry.
   // This helps identification of the thread by the components using
-  // ThreadRegistry
+  // ThreadRegistry. The lowest free tid is allocated, lock-free.
+  // The tid is released at thread exit, if UnregisterThread isn't called.
   static bool RegisterThread();
 
   // Unregister thread from ThreadRegistry.
   static void UnregisterThread();
 
   // Returns thread id allocated for this thread.
-  // NOTE: RegisterThread must be called, before using this function.
-  static thread_id_t ThreadID();
+  // Threads which didn't call RegisterThread, are registered on first use.
+  static thread_id_t ThreadID() {
+    if (__builtin_expect(t_tid != INVALID_THREADID, 1))
+      return t_tid;
+
+    return RegisterThreadSlow();
+  }
+
+  // Returns the generation of `tid`, which is bumped every time the tid is
+  // allocated and released. So it's odd, only while `tid` is registered, and
+  // identifies the thread it's registered to.
+  static std::uint32_t Generation(thread_id_t tid);
+
+  static bool IsRegistered(thread_id_t tid) { return Generation(tid) % 2 != 0; }
+
+  // Returns Generation(ThreadID()), without the lookup.
+  static std::uint32_t ThreadGeneration() {
+    ThreadID();
+    return t_generation;
+  }
 
   // Returns # active (registered) threads.
   static std::uint32_t NumRegisteredThreads();
 
   // Returns Max tid allocated for among all active threads.
-  // This is always >= NumRegisterdThreads()
+  // This is always >= NumRegisterdThreads(), and may overestimate only while
+  // threads are being (un)registered concurrently: it's exact once they
+  // return.
   static thread_id_t MaxThreadID();
+
+  // Call `func(tid)` for every registered tid, in increasing order.
+  // Free tids are skipped a word (of 64 tids) at a time, so the cost is
+  // proportional to the # registered threads, rather than MaxThreadID().
+  template <typename Func> static void ForEachThread(Func &&func) {
+    auto max_tid = MaxThreadID();
+
+    if (max_tid == INVALID_THREADID)
+      return;
+
+    for (std::uint32_t word = 0; word <= max_tid / 64; word++) {
+      for (auto used = UsedTids(word); used != 0; used &= used - 1)
+        func(static_cast<thread_id_t>(word * 64 + __builtin_ctzll(used)));
+    }
+  }
+
+  // Returns the bitmap of registered tids [word * 64, word * 64 + 64).
+  static std::uint64_t UsedTids(std::uint32_t word);
+
+  // When enabled, the tid freed by a thread is cached for its CPU, and handed
+  // out to the next thread registering on that CPU, instead of the lowest
+  // free tid. So the tid's slots (see ThreadSlots) are likely to still be in
+  // that CPU's cache. A cached tid is only reused, if it's below
+  // MaxThreadID(), so tids are kept as dense. Disabled by default.
+  static void SetTidRecycling(bool enable);
+
+  // CPU topology, read from /sys once on first use.
+  // Without it, all the (online) CPUs are placed in node 0.
+  static std::uint32_t NumCPUs();
+  static std::uint32_t NumNodes();
+  static std::uint32_t NodeOfCPU(std::uint32_t cpu);
+
+  // Returns the CPU the calling thread (recently) ran on.
+  // It's cached per thread, and refreshed once every CPU_REFRESH_INTERVAL
+  // calls, so it's only a hint, as the thread may have migrated since.
+  static std::uint32_t CurrentCPU() {
+    if (__builtin_expect(t_cpu_countdown != 0, 1)) {
+      t_cpu_countdown--;
+      return t_cpu;
+    }
+
+    return RefreshCPU();
+  }
+
+  // Returns the NUMA node of CurrentCPU().
+  static std::uint32_t CurrentNode() {
+    CurrentCPU();
+    return t_node;
+  }
+
+  // Makes the next CurrentCPU() call of the calling thread refresh the CPU.
+  // Called when the thread wakes up from ParkingLot::park, as threads mostly
+  // migrate while asleep.
+  static void MarkCPUStale() { t_cpu_countdown = 0; }
+
+  // Returns the CPU and node, last seen by registered thread `tid`. They are
+  // refreshed when the thread registers, and whenever its CurrentCPU()
+  // rereads the CPU.
+  static std::uint32_t CPU(thread_id_t tid);
+  static std::uint32_t Node(thread_id_t tid);
+
+  // Fills `tids` with the registered threads, last seen on `node`.
+  static void ThreadsOnNode(std::uint32_t node, std::vector<thread_id_t> &tids);
+
+private:
+  __attribute__((noinline, cold)) static thread_id_t RegisterThreadSlow();
+  __attribute__((noinline)) static std::uint32_t RefreshCPU();
+
+  // ID of calling thread, and its generation
+  static inline thread_local thread_id_t t_tid = INVALID_THREADID;
+  static inline thread_local std::uint32_t t_generation = 0;
+
+  // CurrentCPU() cache
+  static inline thread_local std::uint32_t t_cpu = 0;
+  static inline thread_local std::uint32_t t_node = 0;
+  static inline thread_local std::uint32_t t_cpu_countdown = 0;
 };
 } // namespace sync_prim
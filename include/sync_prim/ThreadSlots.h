@@ -0,0 +1,168 @@
+#pragma once
+
+#include "ThreadRegistry.h"
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+namespace sync_prim {
+// Per-thread storage: a `T` for every registered thread, indexed by its tid.
+//
+// Slots are padded to cache lines, so that threads don't false share, and
+// are allocated lazily, one segment of `SEGMENT_SIZE` tids at a time, when a
+// tid in that segment accesses its slot for the first time. So the memory
+// used is proportional to MaxThreadID(), rather than MAX_THREADS. Segments are
+// only freed with the ThreadSlots, as tids are recycled.
+//
+// A slot is reset when it's first accessed by a new owner (see `local`), i.e.
+// after its tid is recycled. `for_each_owned_ever` may still be reading the
+// slot meanwhile, so a `Reset` should reset it in place, through atomics (or
+// retain it, for eg: sequence #s, which must never go back). The default
+// reset constructs a new `T` over the old one, so it's only for trivially
+// destructible `T`s, whose slots aren't read by `for_each_owned_ever`
+// concurrently with a new owner.
+template <typename T> class ThreadSlots {
+public:
+  using thread_id_t = ThreadRegistry::thread_id_t;
+  using Reset = void (*)(T &value);
+
+  static constexpr std::size_t CACHE_LINE_SIZE = 128;
+  static constexpr std::uint32_t SEGMENT_SIZE = 64;
+
+  constexpr explicit ThreadSlots(Reset reset = &reconstruct)
+      : m_reset(reset) {}
+  ThreadSlots(const ThreadSlots &) = delete;
+
+  ~ThreadSlots() {
+    for (auto &segment : m_segments)
+      delete segment.load(std::memory_order_relaxed);
+  }
+
+  // Slot of the calling thread, reset if it's not owned by it yet.
+  T &local() {
+    auto tid = ThreadRegistry::ThreadID();
+    auto generation = ThreadRegistry::ThreadGeneration();
+    Slot &slot = get_slot(tid);
+
+    if (slot.generation.load(std::memory_order_relaxed) != generation)
+      reset(slot, generation);
+
+    return slot.value;
+  }
+
+  // Slot of `tid`, as is. The caller must know that `tid` is alive, and has
+  // already accessed its slot through `local`.
+  T &operator[](thread_id_t tid) { return get_slot(tid).value; }
+
+  // Call `func(tid, value)` for the slots of registered threads, which are
+  // owned by them. Slots are not locked, so `T` must be safe to read
+  // concurrently with its owner.
+  template <typename Func> void for_each(Func &&func) {
+    ThreadRegistry::ForEachThread([&](thread_id_t tid) {
+      Segment *segment = m_segments[tid / SEGMENT_SIZE].load(
+          std::memory_order_acquire);
+
+      if (segment == nullptr)
+        return;
+
+      Slot &slot = (*segment)[tid % SEGMENT_SIZE];
+      auto generation = ThreadRegistry::Generation(tid);
+
+      if (generation % 2 != 0 &&
+          slot.generation.load(std::memory_order_acquire) == generation)
+        func(tid, slot.value);
+    });
+  }
+
+  // Call `func(tid, value)` for every slot ever owned, including those of
+  // exited threads, which are left as is until their tid is reused.
+  template <typename Func> void for_each_owned_ever(Func &&func) {
+    auto num_segments = m_num_segments.load(std::memory_order_acquire);
+
+    for (std::uint32_t i = 0; i < num_segments; i++) {
+      Segment *segment = m_segments[i].load(std::memory_order_acquire);
+
+      if (segment == nullptr)
+        continue;
+
+      for (std::uint32_t j = 0; j < SEGMENT_SIZE; j++) {
+        Slot &slot = (*segment)[j];
+
+        if (slot.generation.load(std::memory_order_acquire) != 0)
+          func(i * SEGMENT_SIZE + j, slot.value);
+      }
+    }
+  }
+
+private:
+  struct alignas(CACHE_LINE_SIZE) Slot {
+    T value{};
+    // ThreadRegistry::Generation of the owner, 0 if never owned.
+    std::atomic<std::uint32_t> generation{0};
+  };
+
+  static constexpr std::uint32_t NUM_SEGMENTS =
+      ThreadRegistry::MAX_THREADS / SEGMENT_SIZE;
+
+  using Segment = std::array<Slot, SEGMENT_SIZE>;
+
+  Slot &get_slot(thread_id_t tid) {
+    assert(tid < ThreadRegistry::MAX_THREADS);
+
+    auto &segment = m_segments[tid / SEGMENT_SIZE];
+    Segment *slots = segment.load(std::memory_order_acquire);
+
+    if (slots == nullptr)
+      slots = allocate_segment(tid / SEGMENT_SIZE);
+
+    return (*slots)[tid % SEGMENT_SIZE];
+  }
+
+  __attribute__((noinline)) Segment *allocate_segment(std::uint32_t index) {
+    auto &segment = m_segments[index];
+    auto *new_segment = new Segment{};
+    Segment *expected = nullptr;
+
+    // Lost the race, use the segment installed by the other thread.
+    if (!segment.compare_exchange_strong(expected, new_segment,
+                                         std::memory_order_acq_rel)) {
+      delete new_segment;
+      return expected;
+    }
+
+    auto num_segments = m_num_segments.load();
+
+    while (num_segments <= index &&
+           !m_num_segments.compare_exchange_weak(num_segments, index + 1)) {
+    }
+
+    return new_segment;
+  }
+
+  // Default Reset, instantiated only if it's used.
+  static void reconstruct(T &value) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "ThreadSlots of this T needs a Reset, resetting in place");
+
+    value.~T();
+    new (&value) T{};
+  }
+
+  __attribute__((noinline)) void reset(Slot &slot, std::uint32_t generation) {
+    // First owner gets a freshly constructed `T`.
+    if (slot.generation.load(std::memory_order_relaxed) != 0)
+      m_reset(slot.value);
+
+    slot.generation.store(generation, std::memory_order_release);
+  }
+
+  const Reset m_reset;
+  std::array<std::atomic<Segment *>, NUM_SEGMENTS> m_segments{};
+  // Max index of an allocated segment + 1
+  std::atomic<std::uint32_t> m_num_segments{0};
+};
+} // namespace sync_prim
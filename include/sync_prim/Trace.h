@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cinttypes>
+
+// Trace points of the primitives (see TraceLog), for a timeline of lock
+// behavior under load: lock holds, waits (park / unpark), failed try_locks,
+// contention, timeouts, FairMutex handoffs and deadlock victims.
+//
+// Trace points are compiled in only when SYNC_PRIM_ENABLE_TRACING is defined
+// (the SYNC_PRIM_ENABLE_TRACING CMake option), otherwise they (and their
+// arguments) generate no code at all. Arguments are still named in an
+// unevaluated operand then, so variables kept only for tracing don't turn
+// unused.
+#ifdef SYNC_PRIM_ENABLE_TRACING
+#include "TraceLog.h"
+
+#define SYNC_PRIM_TRACE(...) ::sync_prim::TRACELOG(__VA_ARGS__)
+#else
+#define SYNC_PRIM_TRACE(...)                                                   \
+  static_cast<void>(sizeof(::sync_prim::detail::trace_args_unused(__VA_ARGS__)))
+#endif
+
+namespace sync_prim {
+#ifndef SYNC_PRIM_ENABLE_TRACING
+namespace detail {
+// Never defined, only used in sizeof (see SYNC_PRIM_TRACE).
+template <typename... Args> int trace_args_unused(const Args &...);
+} // namespace detail
+#endif
+
+namespace trace {
+// Formats of the trace points. They are printf formats, given the tid and
+// 2 uintptr_t params (the lock or parking key first). Exporters (see
+// TraceLog::dumpChromeTrace) recognize events by the address of these.
+inline constexpr char LOCK_ACQUIRED[] = "[%d] acquired 0x%" PRIxPTR;
+inline constexpr char LOCK_RELEASED[] = "[%d] released 0x%" PRIxPTR;
+inline constexpr char TRY_LOCK_FAILED[] = "[%d] try_lock 0x%" PRIxPTR
+                                          " failed";
+inline constexpr char CONTENDED[] = "[%d] contended 0x%" PRIxPTR;
+inline constexpr char HANDOFF[] = "[%d] handoff 0x%" PRIxPTR " to %" PRIuPTR;
+
+inline constexpr char PARK[] = "[%d] park 0x%" PRIxPTR;
+inline constexpr char UNPARKED[] = "[%d] unparked 0x%" PRIxPTR;
+inline constexpr char PARK_TIMEOUT[] = "[%d] park 0x%" PRIxPTR " timed out";
+inline constexpr char UNPARK[] = "[%d] unpark 0x%" PRIxPTR ", scanned %" PRIuPTR
+                                 " nodes";
+
+inline constexpr char DEADLOCK_VICTIM[] = "[%d] deadlock victim %" PRIuPTR
+                                          ", of %" PRIuPTR " waiters";
+} // namespace trace
+} // namespace sync_prim
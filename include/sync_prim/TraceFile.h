@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace sync_prim {
+namespace trace_file {
+// Layout of a TraceLog file (see TraceLog::mapFile), which outlives the
+// process, so that the last events can be decoded (with trace_decoder) after
+// a crash or hang.
+//
+//   Header | Format[numFormats] | (RingHeader | Event[eventsPerRing]) ...
+//
+// The file is self-describing: the header has the offsets of every section,
+// and of every field of an event, so a decoder doesn't depend on the layout
+// of TraceLog::Event of the process which wrote the file.
+//
+// Events refer to their format by address, which is only meaningful in the
+// process that logged them. So the text of each format is copied into the
+// format table (a hash table keyed by the address) the first time it's
+// logged.
+inline constexpr char MAGIC[8] = {'S', 'P', 'T', 'R', 'A', 'C', 'E', '\0'};
+inline constexpr std::uint32_t VERSION = 1;
+
+struct Header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t headerSize;
+
+  // Format table
+  std::uint64_t formatsOffset;
+  std::uint32_t formatSize;
+  std::uint32_t numFormats;
+
+  // Rings of events, one per tid in [0, numRings)
+  std::uint64_t ringsOffset;
+  std::uint64_t ringSize;
+  std::uint64_t eventsOffset; // from the start of a ring
+  std::uint32_t numRings;
+  std::uint32_t eventSize;
+  std::uint64_t eventsPerRing; // power of 2
+
+  // Fields of an event: tid is an int, the rest are pointer sized, but tsc.
+  std::uint32_t pointerSize;
+  std::uint32_t tidOffset;
+  std::uint32_t fmtOffset;
+  std::uint32_t param1Offset;
+  std::uint32_t param2Offset;
+  std::uint32_t tscOffset;
+
+  // To convert event timestamps, see TraceLog::ticksPerNanosecond
+  double ticksPerNanosecond;
+};
+
+inline constexpr std::uint32_t NUM_FORMATS = 1024;
+inline constexpr std::size_t MAX_FORMAT_LENGTH = 115;
+
+struct alignas(128) Format {
+  // Address of the format in the logging process, 0 if the entry is free.
+  std::atomic<std::uint64_t> fmt;
+  // Set once `text` is copied.
+  std::atomic<std::uint32_t> ready;
+  char text[MAX_FORMAT_LENGTH + 1];
+};
+
+struct alignas(64) RingHeader {
+  // # events ever logged to the ring, the last `eventsPerRing` of which are
+  // in the ring.
+  std::atomic<std::uint64_t> count;
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+              "trace files are shared through lock free atomics");
+
+// Slot of the format table, where lookup for `fmt` starts.
+inline std::uint32_t formatSlot(std::uint64_t fmt, std::uint32_t numFormats) {
+  return ((fmt * 0x9E3779B97F4A7C15ull) >> 32) & (numFormats - 1);
+}
+} // namespace trace_file
+} // namespace sync_prim
@@ -10,16 +10,36 @@
 #pragma once
 
 #include "ThreadRegistry.h"
+#include "ThreadSlots.h"
+#include "TraceFile.h"
 
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
-#include <mutex>
+#include <vector>
+
+#include <folly/Indestructible.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 namespace sync_prim {
 //---------------------------------------------------------
 // Logs TRACE events to memory.
-// Iterator should only be used after logging is complete.
+// Every thread logs to its own ring buffer (indexed by its tid), so logging
+// never writes a cache line shared with other threads. Iterator merges the
+// buffers by timestamp, and should only be used after logging is complete.
 // Useful for post-mortem debugging and for validating tests.
+//
+// Events are timestamped with the cycle counter (rdtsc, ~25 cycles, no
+// syscall or vDSO call), which is converted to nanoseconds only when the log
+// is read, using a one time calibration against steady_clock. This assumes
+// an invariant TSC, synchronized across CPUs, as on all recent x86 CPUs.
+//
+// The buffers can instead be mapped from a file (see mapFile), whose events
+// survive a crash of the process, and are read by the trace_decoder tool.
 //---------------------------------------------------------
 class TraceLog {
 public:
@@ -28,117 +48,210 @@ public:
     const char *fmt;
     uintptr_t param1;
     uintptr_t param2;
+    // Cycle counter, see TraceLog::toNanoseconds
+    std::uint64_t tsc;
 
-    Event() : fmt(NULL), param1(0), param2(0) {}
+    Event() : fmt(NULL), param1(0), param2(0), tsc(0) {}
   };
 
+  // Each thread keeps its most recent EventsPerThread events.
+  static constexpr unsigned EventsPerThread = 16384;
+  static_assert((EventsPerThread & (EventsPerThread - 1)) == 0,
+                "buffers are indexed by masking");
+
 private:
-  static constexpr unsigned MaxNumPages = 4;
-  static constexpr unsigned EventsPerPage = 16384;
+  struct ThreadBuffer {
+    // Ring of `mask + 1` events, set on the first event. Either heapEvents,
+    // or a ring of the mapped file.
+    Event *events = nullptr;
+    std::uint64_t mask = 0;
+    // # events ever logged, only written by the owner. Either heapCount, or
+    // the count of the ring in the file.
+    std::atomic<std::uint64_t> *count = &heapCount;
+
+    std::unique_ptr<Event[]> heapEvents;
+    std::atomic<std::uint64_t> heapCount{0};
+  };
 
-  struct Page {
-    Page *next;
-    // This can exceed EVENTS_PER_PAGE, but it's harmless. Just means page is
-    // full.
-    std::atomic<int> index;
-    Event events[EventsPerPage];
+  // Buffers are kept when their thread exits, and carried on by the next
+  // thread with the same tid.
+  static void keepBuffer(ThreadBuffer &) {}
 
-    Page() : next(NULL), index(0) {}
-  };
+  __attribute__((noinline)) void allocateBuffer(ThreadBuffer &buffer);
+
+  // Copies `fmt` to the format table of the file, if it isn't there already.
+  // If the table is full, events of `fmt` are decoded without their text.
+  static void registerFormat(trace_file::Header &file, const char *fmt) {
+    auto *formats = reinterpret_cast<trace_file::Format *>(
+        reinterpret_cast<char *>(&file) + file.formatsOffset);
+    auto key = reinterpret_cast<std::uintptr_t>(fmt);
+    auto mask = file.numFormats - 1;
+    auto slot = trace_file::formatSlot(key, file.numFormats);
+
+    // Linear probing, up to the first free slot, where `fmt` would go.
+    for (std::uint32_t i = 0; i < file.numFormats; i++) {
+      auto &format = formats[(slot + i) & mask];
+      auto found = format.fmt.load(std::memory_order_relaxed);
+
+      if (__builtin_expect(found == key, 1))
+        return;
+
+      if (found == 0) {
+        insertFormat(formats, file.numFormats, (slot + i) & mask, fmt);
+        return;
+      }
+    }
+  }
 
-  // Store events in a linked list of pages.
-  // Mutex is only locked when it's time to allocate a new page.
-  std::mutex m_mutex;
-  Page *m_head;
-  std::atomic<Page *> m_tail;
-  unsigned m_numPages; // Protected by m_mutex
+  __attribute__((noinline)) static void
+  insertFormat(trace_file::Format *formats, std::uint32_t numFormats,
+               std::uint32_t slot, const char *fmt);
+
+  // Cycle counter, or steady_clock nanoseconds, where there's none.
+  static std::uint64_t readTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  ThreadSlots<ThreadBuffer> m_buffers;
 
-  Event *allocateEventFromNewPage();
+  // Mapped file, if any (see mapFile).
+  std::atomic<trace_file::Header *> m_file{nullptr};
+  std::size_t m_fileSize = 0;
 
 public:
-  TraceLog();
+  TraceLog() : m_buffers(&keepBuffer) {}
+  TraceLog(const TraceLog &) = delete;
   ~TraceLog();
 
   void log(const char *fmt, uintptr_t param1, uintptr_t param2) {
     std::atomic_signal_fence(std::memory_order_seq_cst); // Compiler barrier
 
-    Page *page = m_tail.load(std::memory_order_consume);
-    Event *evt;
-    int index = page->index.fetch_add(1, std::memory_order_relaxed);
+    ThreadBuffer &buffer = m_buffers.local();
+
+    if (__builtin_expect(!buffer.events, 0))
+      allocateBuffer(buffer);
 
-    if (static_cast<unsigned>(index) < EventsPerPage)
-      evt = &page->events[index];
-    else
-      evt = allocateEventFromNewPage(); // Double-checked locking is performed
-                                        // inside here.
+    if (auto *file = m_file.load(std::memory_order_relaxed))
+      registerFormat(*file, fmt);
 
-    evt->tid = ThreadRegistry::ThreadID();
-    evt->fmt = fmt;
-    evt->param1 = param1;
-    evt->param2 = param2;
+    auto count = buffer.count->load(std::memory_order_relaxed);
+    Event &evt = buffer.events[count & buffer.mask];
+
+    evt.tid = ThreadRegistry::ThreadID();
+    evt.fmt = fmt;
+    evt.param1 = param1;
+    evt.param2 = param2;
+    evt.tsc = readTsc();
+
+    // Nobody else writes the buffer, so a plain store is enough to publish
+    // the event (no shared fetch_add).
+    buffer.count->store(count + 1, std::memory_order_release);
 
     std::atomic_signal_fence(std::memory_order_seq_cst); // Compiler barrier
   }
 
   // Iterators are meant to be used only after all logging is complete.
-  friend class Iterator;
+  // Events of all the threads are visited in timestamp order, and events of
+  // a thread in the order they were logged.
   class Iterator {
   private:
-    Page *m_page;
-    int m_index;
+    // Unvisited events of a thread [pos, end), indexed modulo the size of
+    // its ring.
+    struct Cursor {
+      const Event *events;
+      std::uint64_t mask;
+      std::uint64_t pos;
+      std::uint64_t end;
+
+      const Event &event() const { return events[pos & mask]; }
+    };
+
+    // Min-heap of non empty cursors, by the time of their next event.
+    std::vector<Cursor> m_heap;
+
+    static bool later(const Cursor &a, const Cursor &b) {
+      return a.event().tsc > b.event().tsc;
+    }
+
+    explicit Iterator(std::vector<Cursor> cursors);
+
+    friend class TraceLog;
 
   public:
-    Iterator(Page *p, int i) : m_page(p), m_index(i) {}
-
-    Iterator &operator++() {
-      m_index++;
-
-      if (static_cast<unsigned>(m_index) >= EventsPerPage) {
-        Page *next = m_page->next;
-        if (next) {
-          m_page = next;
-          m_index = 0;
-        } else {
-          m_index = m_page->index.load(std::memory_order_relaxed);
-        }
-      }
+    Iterator() = default;
 
-      return *this;
-    }
+    Iterator &operator++();
 
+    // Only meant for comparing against end().
     bool operator!=(const Iterator &other) const {
-      return (m_page != other.m_page) || (m_index != other.m_index);
+      return m_heap.size() != other.m_heap.size();
     }
 
-    const Event &operator*() const { return m_page->events[m_index]; }
+    const Event &operator*() const { return m_heap.front().event(); }
   };
 
-  Iterator begin() { return Iterator(m_head, 0); }
-
-  Iterator end() {
-    Page *tail = m_tail.load(std::memory_order_relaxed);
-
-    return Iterator(tail, tail->index.load(std::memory_order_relaxed));
+  Iterator begin();
+  Iterator end() { return Iterator(); }
+
+  // Logs the events of tids below `numRings` to `path` (created, or
+  // truncated), in rings of `eventsPerRing` (rounded up to a power of 2)
+  // events, instead of to memory. The file is mapped shared, so events
+  // logged before a crash or hang can be read back by trace_decoder, and
+  // logging stays free of allocations and syscalls.
+  //
+  // Must be called before any thread logs: threads that already have a
+  // buffer keep logging to memory, as do tids >= numRings. Can be called only
+  // once. Returns false if the file can't be created or mapped.
+  bool mapFile(const char *path, std::uint32_t numRings = 64,
+               std::uint64_t eventsPerRing = EventsPerThread);
+
+  // # Cycle counter ticks per nanosecond, measured on the first call (which
+  // takes ~10ms).
+  static double ticksPerNanosecond();
+
+  // Converts a difference of Event::tsc, to nanoseconds.
+  static double toNanoseconds(std::uint64_t ticks) {
+    return ticks / ticksPerNanosecond();
   }
 
   void dumpStats();
-  void dumpEntireLog(const char *path = nullptr, unsigned startPage = 0);
 
-  static TraceLog Instance;
+  // Events are printed with their time relative to the first event (in
+  // microseconds), so that hold and wait times can be read off the log.
+  // Writes to stderr, if there's no `path`. Returns false, if `path` can't be
+  // written.
+  bool dumpEntireLog(const char *path = nullptr);
+
+  // Writes the log in Chrome's Trace Event (JSON) format, which can be
+  // loaded into chrome://tracing or ui.perfetto.dev. Every tid gets a track,
+  // on which the trace points of the primitives (see Trace.h) are drawn as
+  // hold and wait slices (from acquire to release, park to unpark), and the
+  // rest as instant events. Returns false, if `path` can't be written.
+  bool dumpChromeTrace(const char *path);
+
+  // Never destroyed, so that trace points hit at exit (from static or TLS
+  // destructors, or detached threads) don't log to freed buffers.
+  static folly::Indestructible<TraceLog> Instance;
 };
 
 template <typename Param1, typename Param2>
 static inline void TRACELOG(const char *fmt, Param1 p1, Param2 p2) {
-  TraceLog::Instance.log(fmt, (uintptr_t)p1, (uintptr_t)p2);
+  TraceLog::Instance->log(fmt, (uintptr_t)p1, (uintptr_t)p2);
 }
 
 template <typename Param1>
 static inline void TRACELOG(const char *fmt, Param1 p1) {
-  TraceLog::Instance.log(fmt, (uintptr_t)p1, 0);
+  TraceLog::Instance->log(fmt, (uintptr_t)p1, 0);
 }
 
 static inline void TRACELOG(const char *fmt) {
-  TraceLog::Instance.log(fmt, 0, 0);
+  TraceLog::Instance->log(fmt, 0, 0);
 }
 
 } // namespace sync_prim
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+namespace sync_prim {
+struct DeadlockDetectionOptions {
+  // A waiter becomes a deadlock candidate after waiting this long.
+  std::chrono::milliseconds timeout{100};
+  // Bounds of the interval between two consecutive detection passes.
+  std::chrono::milliseconds min_poll_interval{1};
+  std::chrono::milliseconds max_poll_interval{1000};
+  // Poll interval is scaled up by one step for every these many parked
+  // waiters (as is the cost of a pass).
+  std::size_t waiters_per_poll_step = 64;
+};
+
+namespace detail {
+// Background thread driving a DeadlockDetector.
+//
+// Instead of polling at a fixed period, a detection pass is only started once
+// the oldest parked waiter has been waiting for `timeout`. Passes are then
+// rate limited by a poll interval, which doubles after every pass that finds
+// no deadlock, so long legitimate waits don't cost a pass every
+// `min_poll_interval`, and grows with the # parked waiters (as does the cost
+// of a pass), up to `max_poll_interval`. It's reset, when the oldest waiter
+// leaves, and a waiter which parked after the last pass, gets a pass once
+// it's been waiting for `timeout`, regardless of the interval. When nobody is
+// parked, the service goes dormant until the detector reports a new waiter.
+class DeadlockDetectionService {
+public:
+  using Clock = std::chrono::steady_clock;
+  using TimePoint = Clock::time_point;
+
+  using Options = DeadlockDetectionOptions;
+
+  // Parked waiters, as seen by the detector.
+  struct Waiters {
+    std::size_t count = 0;
+    // Valid only if `count` != 0.
+    TimePoint oldest_wait_start{};
+    // Of the waiters, which started waiting after `since` (see Hooks).
+    TimePoint oldest_new_wait_start = TimePoint::max();
+  };
+
+  // Functions of the detector being served.
+  struct Hooks {
+    Waiters (*parked_waiters)(TimePoint since);
+    int (*detect_deadlocks)();
+  };
+
+  explicit DeadlockDetectionService(Hooks hooks);
+  DeadlockDetectionService(const DeadlockDetectionService &) = delete;
+  ~DeadlockDetectionService();
+
+  // Starts the service thread, returns false if it's already running.
+  bool start(Options options = Options{});
+
+  // Stops and joins the service thread.
+  void stop();
+
+  bool is_running() const;
+
+  // Called by the detector, every time a thread parks, after publishing its
+  // wait record (and a seq_cst fence). Wakes up the service, if dormant,
+  // otherwise it's a single load.
+  void notify_waiter_parked();
+
+  // # deadlocks broken since the service was started.
+  int num_deadlocks() const;
+
+private:
+  void worker();
+  std::chrono::milliseconds poll_interval(std::chrono::milliseconds backoff,
+                                          std::size_t num_waiters) const;
+
+  const Hooks m_hooks;
+  Options m_options{};
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_cond;
+  std::thread m_thread;
+  bool m_running = false;
+  bool m_stop = false;
+  bool m_waiter_parked = false;
+  // Set while the service is (about to go) dormant.
+  std::atomic<bool> m_dormant = false;
+  int m_num_deadlocks = 0;
+};
+} // namespace detail
+} // namespace sync_prim
@@ -1,215 +1,544 @@
 #pragma once
 
+#include "DeadlockDetectionService.h"
+#include "DeadlockReport.h"
 #include "sync_prim/ParkingLot.h"
 #include "sync_prim/ThreadRegistry.h"
+#include "sync_prim/ThreadSlots.h"
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <bitset>
 #include <cassert>
 #include <chrono>
 #include <cinttypes>
+#include <cstddef>
+#include <limits>
+#include <mutex>
 #include <optional>
-#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <folly/Indestructible.h>
 
 namespace sync_prim {
+// A waiter of a lockcycle, as seen by the VictimPolicy.
+struct DeadlockCycleMember {
+  ThreadRegistry::thread_id_t tid;
+  // Lock being waited on, and the name of its type.
+  const void *lock;
+  const char *lock_type;
+  std::uint64_t wait_token;
+  std::chrono::steady_clock::time_point wait_start_time;
+  // # deadlock-safe locks held by the waiter.
+  std::uint32_t num_held_locks;
+  // Set by the waiter (see set_deadlock_priority and set_deadlock_cost)
+  int priority;
+  std::uint64_t cost;
+};
+
+// Chooses the waiter to abort, to break a lockcycle.
+// Returns index of the victim in `members`.
+using VictimPolicy = std::size_t (*)(const DeadlockCycleMember *members,
+                                     std::size_t num_members);
+
+namespace victim_policy {
+// Waiter, which started waiting last (default).
+std::size_t youngest(const DeadlockCycleMember *members,
+                     std::size_t num_members);
+
+// Waiter holding the least # locks.
+std::size_t fewest_held_locks(const DeadlockCycleMember *members,
+                              std::size_t num_members);
+
+// Waiter with the lowest priority.
+std::size_t lowest_priority(const DeadlockCycleMember *members,
+                            std::size_t num_members);
+
+// Waiter with the lowest cost.
+std::size_t lowest_cost(const DeadlockCycleMember *members,
+                        std::size_t num_members);
+} // namespace victim_policy
+
 namespace detail {
 
 struct empty_t {};
 
-template <typename Mutex> class DeadlockDetector;
+// Type erased interface of a deadlock-safe lock type. Every lock type (mutex,
+// fair mutex, shared lock, ...) registers one of these with the
+// DeadlockDetector, so that a single detection pass sees the waiters and
+// holders of all of them, and can find cycles spanning different lock types.
+struct DeadlockSafeLockType {
+  using thread_id_t = ThreadRegistry::thread_id_t;
+  using WaitToken = std::uint64_t;
+
+  const char *name;
 
-template <> class DeadlockDetector<empty_t> {
-public:
-  using WaitToken = empty_t;
+  // Append the holder(s) of `lock` to `holders`. Exclusive locks have at most
+  // one holder, shared locks may report every reader.
+  void (*get_holders)(const void *lock, std::vector<thread_id_t> &holders);
+
+  // Unpark `tid` parked on `lock` with `wait_token`, as a deadlock victim.
+  // DeadlockDetector::mark_dead_locked(tid) must be called before the waiter
+  // is woken up. Returns false, if the waiter is no longer parked.
+  bool (*unpark_waiter)(const void *lock, thread_id_t tid,
+                        WaitToken wait_token);
 };
 
+// The wait-for graph is maintained incrementally: every parked thread
+// publishes the lock it's waiting on in its own wait record, on `init_park`
+// and `fini_park`, while the holder side of each edge is the lock word itself
+// (updated on lock acquisition). Parking writes nothing shared with other
+// threads, and a detection pass reads the wait records of the registered
+// threads (see ThreadSlots::for_each) without any lock.
+//
+// There is a single detector for all the deadlock-safe lock types (see
+// DeadlockSafeLockType).
+//
 // 1) Gather snapshot of all waiters and their associated lock
-// information (who's holding the lock).
+// information (who's holding the lock). Each thread publishes its wait
+// record under a seqlock, so the snapshot is taken without the ParkingLot
+// bucket locks, and doesn't slow down the lock traffic.
 //
-// 2) Obtain a lockcycle (unconfirmed-deadlock cycle) if any.
-//    If a lockcycle couldn't be found, it means no deadlock is present.
+// 2) Find every lockcycle (unconfirmed-deadlock cycle) in a single pass,
+//    by computing the strongly connected components of the wait-for graph
+//    (Tarjan's algorithm). Each component with more than one waiter (or a
+//    waiter waiting on a lock it holds) is a lockcycle.
+//    If no lockcycle could be found, it means no deadlock is present.
 //
-// 3) Verify the cycle by checking if all the waiters are still waiting for
+// 3) Verify each cycle by checking if all the waiters are still waiting for
 //    the same lock.
 //
-// 4) Finally, break deadlock by unparking a waiter in the lockcycle, after
-//    verifying, that the waiter wasn't awakened after the verification step
-//    above (confirmation done is by checking the wait token, obtained as
-//    part of step 1)
-template <typename Mutex> class DeadlockDetector {
+// 4) Finally, break every deadlock by unparking one waiter per lockcycle,
+//    after verifying, that the waiter wasn't awakened after the verification
+//    step above (confirmation done is by checking the wait token, obtained
+//    as part of step 1)
+class DeadlockDetector {
 public:
-  using WaitToken = std::uint64_t;
+  using WaitToken = DeadlockSafeLockType::WaitToken;
+  using lock_type_id_t = std::uint16_t;
 
-  // WaitNodeDataType must have following members
-  //   ThreadRegistry::thread_id_t get_waiter_id();
-  //   WaitToken get_wait_token();
-  template <typename WaitNodeDataType>
-  bool run(sync_prim::ParkingLot<WaitNodeDataType> &parkinglot) {
-    gather_waiters_and_holders_info(parkinglot);
+  // Maximum # lock types, which can be registered.
+  static constexpr std::size_t MAX_LOCK_TYPES = 64;
 
-    for (auto &waiter : m_waiters) {
-      auto lockcycle = detect_lock_cycle(waiter.first, waiter.second);
+  DeadlockDetector() = default;
+  DeadlockDetector(const DeadlockDetector &) = delete;
 
-      if (verify_lock_cycle(parkinglot, lockcycle))
-        return true;
-    }
+  // Register a lock type, `lock_type` must outlive the detector.
+  static lock_type_id_t
+  register_lock_type(const DeadlockSafeLockType *lock_type);
+
+  // Returns # deadlocks broken.
+  int run();
+
+  WaitToken init_park(const void *lock, lock_type_id_t lock_type);
+  bool fini_park();
+
+  // Must be called from the `ToPark` callback of ParkingLot::park, once the
+  // waiter is certain to be enqueued (bucket lock is held).
+  void mark_enqueued() {
+    local_wait_info().mark_enqueued();
+  }
+
+  // Must only be called from DeadlockSafeLockType::unpark_waiter.
+  void mark_dead_locked(ThreadRegistry::thread_id_t tid) {
+    get_wait_info(tid).is_dead_locked = true;
+  }
+
+  // Must be called by the deadlock-safe locks, after acquiring and before
+  // releasing a lock (respectively).
+  void lock_acquired(const void *lock) {
+    local_wait_info().lock_acquired(lock);
+  }
 
-    return false;
+  void lock_released(const void *lock) {
+    local_wait_info().lock_released(lock);
   }
 
-  WaitToken init_park(const Mutex *lock) {
-    auto &thread_info = g_all_waiters_info[ThreadRegistry::ThreadID()];
-    return thread_info.init_park(lock);
+  void set_priority(int priority) {
+    local_wait_info().priority = priority;
   }
 
-  bool fini_park() {
-    auto &thread_info = g_all_waiters_info[ThreadRegistry::ThreadID()];
-    thread_info.fini_park();
-    return thread_info.is_dead_locked;
+  void set_cost(std::uint64_t cost) {
+    local_wait_info().cost = cost;
   }
 
+  void set_victim_policy(VictimPolicy policy) { m_victim_policy = policy; }
+
+  void set_report_sink(DeadlockReportSink sink) { m_report_sink = sink; }
+
+  void set_lock_name(const void *lock, const char *name);
+
+  std::uint64_t scrape_reports(std::uint64_t after_id,
+                               std::vector<DeadlockReport> &reports) const {
+    return m_reports.scrape(after_id, reports);
+  }
+
+  // Reads the wait records of the registered threads in a single pass,
+  // without locks. So it may miss a thread, which is just parking (or
+  // unparking).
+  DeadlockDetectionService::Waiters
+  parked_waiters(DeadlockDetectionService::TimePoint since);
+
+  // # threads enqueued in a ParkingLot, on a lock for which `is_lock(lock)`
+  // is true. Like `parked_waiters`, it's a single pass without locks.
+  template <typename Pred> std::size_t num_parked_on(Pred &&is_lock) {
+    std::size_t count = 0;
+
+    g_wait_infos->for_each([&](thread_id_t, ThreadWaitInfo &info) {
+      auto record = read_wait_record(info);
+
+      if (record && is_lock(record->lock.lock()))
+        count++;
+    });
+
+    return count;
+  }
+
+  // Service to be notified when a thread parks (see
+  // DeadlockDetectionService::notify_waiter_parked).
+  void set_service(DeadlockDetectionService *service) { m_service = service; }
+
+  static DeadlockDetector Instance;
+
 private:
+  using thread_id_t = ThreadRegistry::thread_id_t;
+  using vertex_t = std::uint32_t;
+  using Clock = DeadlockDetectionService::Clock;
+  using TimePoint = DeadlockDetectionService::TimePoint;
+
+  // A lock, and the id of its type. Both are published together through the
+  // wait record (see ThreadWaitInfo), so the type isn't packed into the
+  // address, which may use all of its bits (5-level paging, pointer tagging).
+  class TypedLock {
+  public:
+    TypedLock() = default;
+    TypedLock(const void *lock, lock_type_id_t type)
+        : m_lock(lock), m_type(type) {}
+
+    const void *lock() const { return m_lock; }
+    lock_type_id_t type_id() const { return m_type; }
+    const DeadlockSafeLockType *type() const { return g_lock_types[m_type]; }
+
+    explicit operator bool() const { return m_lock != nullptr; }
+
+    bool operator!=(TypedLock other) const {
+      return m_lock != other.m_lock || m_type != other.m_type;
+    }
+
+  private:
+    const void *m_lock = nullptr;
+    lock_type_id_t m_type = 0;
+  };
+
   struct WaiterInfo {
-    const Mutex *lock;
+    TypedLock lock;
     WaitToken wait_token;
   };
 
-  using thread_id_t = ThreadRegistry::thread_id_t;
-  using LockCycle = std::unordered_map<thread_id_t, WaiterInfo>;
-  using Clock = std::chrono::steady_clock;
-  using TimePoint = Clock::time_point;
+  // Waiter table entry, indexed by tid.
+  struct WaiterEntry {
+    std::uint32_t generation = 0;
+    vertex_t vertex;
+    WaiterInfo info;
+  };
 
-  struct alignas(128) ThreadWaitInfo {
-    WaitToken init_park(const Mutex *lock) {
-      wait_start_time = Clock::now();
-      waiting_on = lock;
-      return ++wait_token;
+  // Open addressing (linear probing) map from a lock to its holders, which
+  // are stored contiguously in `m_holder_tids`.
+  // Capacity is only ever grown, so steady state detection passes don't
+  // allocate.
+  class HolderTable {
+  public:
+    struct Holders {
+      std::uint32_t first;
+      std::uint32_t count;
+    };
+
+    void reset(std::size_t max_locks, std::uint32_t generation);
+    void clear() { m_slots.assign(m_slots.size(), Slot{}); }
+
+    void insert(const void *lock, Holders holders) {
+      m_slots[probe(lock)] = {m_generation, holders, lock};
     }
 
-    void fini_park() {
-      wait_token = 0;
-      waiting_on = nullptr;
+    std::optional<Holders> find(const void *lock) const {
+      const Slot &slot = m_slots[probe(lock)];
+
+      return slot.generation == m_generation ? std::optional{slot.holders}
+                                             : std::nullopt;
     }
 
-    bool is_dead_locked = false;
-    std::atomic<const Mutex *> waiting_on = nullptr;
-    std::atomic<TimePoint> wait_start_time;
-    std::atomic<WaitToken> wait_token = 1;
-  };
+  private:
+    static constexpr std::size_t MIN_CAPACITY = 64;
 
-  template <typename WaitNodeDataType>
-  void gather_waiters_and_holders_info(
-      sync_prim::ParkingLot<WaitNodeDataType> &parkinglot) {
-    m_waiters.clear();
-    m_holders.clear();
+    struct Slot {
+      std::uint32_t generation = 0;
+      Holders holders;
+      const void *lock;
+    };
 
-    thread_id_t waiter_id = 0;
+    // Returns the slot holding `lock` or the free slot it should go into.
+    std::size_t probe(const void *lock) const;
 
-    for (const ThreadWaitInfo &waiter_info : g_all_waiters_info) {
-      WaitToken wait_token = waiter_info.wait_token.load();
-      const Mutex *lock = waiter_info.waiting_on.load();
+    std::vector<Slot> m_slots{};
+    std::uint32_t m_generation = 0;
+  };
 
-      if (lock) {
-        parkinglot.unpark(lock, [&](const WaitNodeDataType &waitdata) {
-          if (waitdata.get_waiter_id() == waiter_id) {
-            if (auto holder = lock->get_holder()) {
-              m_waiters[waiter_id] = {lock, wait_token};
-              m_holders[lock] = *holder;
-            }
+  struct ThreadWaitInfo {
+    WaitToken init_park(TypedLock lock) {
+      WaitToken token = wait_token.load(std::memory_order_relaxed) + 1;
 
-            return UnparkControl::RetainBreak;
-          }
+      is_dead_locked = false;
+      wait_start_time = Clock::now();
 
-          return UnparkControl::RetainContinue;
-        });
-      }
+      begin_update();
+      waiting_on.store(lock.lock(), std::memory_order_relaxed);
+      waiting_on_type.store(lock.type_id(), std::memory_order_relaxed);
+      wait_token.store(token, std::memory_order_relaxed);
+      enqueued.store(false, std::memory_order_relaxed);
+      end_update();
 
-      waiter_id++;
+      return token;
     }
-  }
 
-  LockCycle detect_lock_cycle(thread_id_t waiterid, WaiterInfo winfo) {
-    LockCycle lockcycle;
+    void mark_enqueued() {
+      begin_update();
+      enqueued.store(true, std::memory_order_relaxed);
+      end_update();
+    }
 
-    lockcycle[waiterid] = winfo;
+    void fini_park() {
+      begin_update();
+      waiting_on.store(nullptr, std::memory_order_relaxed);
+      enqueued.store(false, std::memory_order_relaxed);
+      end_update();
+    }
 
-    while (true) {
-      waiterid = m_holders[winfo.lock];
+    // Held locks are only tracked, while the thread isn't parked. So they are
+    // stable, when read by the detector for a lockcycle member.
+    // Locks acquired while `held_locks` is full are only counted.
+    void lock_acquired(const void *lock) {
+      auto tracked = num_tracked_locks.load(std::memory_order_relaxed);
 
-      // Lock holder is not waiting, so not a deadlock.
-      if (m_waiters.count(waiterid) == 0) {
-        lockcycle.clear();
-        return lockcycle;
+      if (tracked < held_locks.size()) {
+        held_locks[tracked].store(lock, std::memory_order_relaxed);
+        num_tracked_locks.store(tracked + 1, std::memory_order_relaxed);
       }
 
-      winfo = m_waiters[waiterid];
+      num_held_locks.store(num_held_locks.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+    }
 
-      // Found a lockcycle, so deadlock
-      if (lockcycle.count(waiterid) != 0) {
-        return lockcycle;
+    void lock_released(const void *lock) {
+      auto tracked = num_tracked_locks.load(std::memory_order_relaxed);
+
+      // Keep the tracked locks dense, by moving the last one into the hole.
+      for (std::size_t i = 0; i < tracked; i++) {
+        if (held_locks[i].load(std::memory_order_relaxed) == lock) {
+          held_locks[i].store(
+              held_locks[tracked - 1].load(std::memory_order_relaxed),
+              std::memory_order_relaxed);
+          held_locks[tracked - 1].store(nullptr, std::memory_order_relaxed);
+          num_tracked_locks.store(tracked - 1, std::memory_order_relaxed);
+          break;
+        }
       }
 
-      lockcycle[waiterid] = winfo;
+      assert(num_held_locks.load(std::memory_order_relaxed) > 0);
+      num_held_locks.store(num_held_locks.load(std::memory_order_relaxed) - 1,
+                           std::memory_order_relaxed);
     }
-  }
-
-  std::optional<thread_id_t> select_waiter(const LockCycle &lockcycle) {
-    TimePoint latest_time;
-    std::optional<thread_id_t> latest_waiter;
 
-    for (const auto &waiter : lockcycle) {
-      const auto &wait_info = g_all_waiters_info[waiter.first];
-      WaitToken wait_token = wait_info.wait_token;
-      const Mutex *lock = wait_info.waiting_on;
-      TimePoint wait_start_time = wait_info.wait_start_time.load();
+    // Forget the previous owner of the tid, except for the wait record, whose
+    // sequence # and wait token must keep increasing.
+    static void reset(ThreadWaitInfo &info) {
+      info.is_dead_locked = false;
+      info.num_held_locks = 0;
+      info.num_tracked_locks = 0;
+      info.priority = 0;
+      info.cost = 0;
+
+      for (auto &held_lock : info.held_locks)
+        held_lock = nullptr;
+    }
 
-      if (latest_time < wait_start_time) {
-        latest_time = wait_start_time;
-        latest_waiter = waiter.first;
-      }
+    void begin_update() {
+      seq.store(seq.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
 
-      // Verify if still waiting for the same `instance` of lock.
-      if (waiter.second.lock != lock || waiter.second.wait_token != wait_token)
-        return {};
+    void end_update() {
+      seq.store(seq.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
     }
 
-    return latest_waiter;
-  }
+    bool is_dead_locked = false;
+    std::atomic<TimePoint> wait_start_time;
+
+    // Wait record, only written by the owning thread. `seq` is odd while
+    // the record is being updated (see read_wait_record).
+    std::atomic<std::uint32_t> seq = 0;
+    std::atomic<const void *> waiting_on = nullptr;
+    std::atomic<lock_type_id_t> waiting_on_type = 0;
+    std::atomic<WaitToken> wait_token = 0;
+    std::atomic<bool> enqueued = false;
+
+    // Only written by the owning thread. All the held locks are counted, but
+    // only the first `num_tracked_locks` are in `held_locks`.
+    std::atomic<std::uint32_t> num_held_locks = 0;
+    std::atomic<std::uint32_t> num_tracked_locks = 0;
+    std::array<std::atomic<const void *>, DeadlockReport::MAX_HELD_LOCKS>
+        held_locks{};
+    std::atomic<int> priority = 0;
+    std::atomic<std::uint64_t> cost = 0;
+  };
 
-  template <typename WaitNodeDataType>
-  bool verify_lock_cycle(sync_prim::ParkingLot<WaitNodeDataType> &parkinglot,
-                         const LockCycle &lockcycle) {
-    if (lockcycle.empty())
-      return false;
+  static constexpr vertex_t NO_VERTEX = std::numeric_limits<vertex_t>::max();
 
-    bool unparked = false;
+  struct TarjanFrame {
+    vertex_t v;
+    std::size_t next_edge;
+  };
 
-    if (auto waiter = select_waiter(lockcycle)) {
-      WaiterInfo &waiter_info = m_waiters[*waiter];
+  // Returns the lock `info` is parked on, if its thread is enqueued in a
+  // ParkingLot.
+  static std::optional<WaiterInfo> read_wait_record(const ThreadWaitInfo &info);
 
-      parkinglot.unpark(waiter_info.lock, [&](WaitNodeDataType waitdata) {
-        if (waitdata.get_waiter_id() == *waiter) {
-          if (waitdata.get_wait_token() == waiter_info.wait_token) {
-            g_all_waiters_info[*waiter].is_dead_locked = true;
-            unparked = true;
-            return UnparkControl::RemoveBreak;
-          }
+  void gather_waiters_and_holders_info();
+  void next_generation();
+  void add_waiter(thread_id_t tid, WaiterInfo info);
 
-          return UnparkControl::RetainBreak;
-        }
+  const WaiterEntry *find_waiter(thread_id_t tid) const {
+    if (tid < m_waiters.size() && m_waiters[tid].generation == m_generation)
+      return &m_waiters[tid];
 
-        return UnparkControl::RetainContinue;
-      });
-    }
+    return nullptr;
+  }
+
+  void build_wait_for_graph();
+  void detect_lock_cycles();
+  void pop_component(vertex_t root);
 
-    return unparked;
+  std::optional<thread_id_t> select_waiter(const thread_id_t *begin,
+                                           const thread_id_t *end);
+  bool verify_lock_cycle(const thread_id_t *begin, const thread_id_t *end);
+  void build_report(const thread_id_t *begin, const thread_id_t *end,
+                    thread_id_t victim);
+
+  // Wait info of the threads, which ever parked or held a lock.
+  static ThreadWaitInfo &get_wait_info(thread_id_t tid) {
+    return (*g_wait_infos)[tid];
   }
 
-  static inline auto g_all_waiters_info =
-      std::array<ThreadWaitInfo, ThreadRegistry::MAX_THREADS>{};
+  static ThreadWaitInfo &local_wait_info() { return g_wait_infos->local(); }
+
+  static inline folly::Indestructible<ThreadSlots<ThreadWaitInfo>>
+      g_wait_infos{&ThreadWaitInfo::reset};
+
+  // Registered lock types, indexed by lock_type_id_t
+  static inline std::array<const DeadlockSafeLockType *, MAX_LOCK_TYPES>
+      g_lock_types{};
+
+  std::atomic<DeadlockDetectionService *> m_service = nullptr;
+  std::atomic<VictimPolicy> m_victim_policy = victim_policy::youngest;
+  std::atomic<DeadlockReportSink> m_report_sink = nullptr;
+
+  std::mutex m_lock_names_mutex;
+  std::unordered_map<const void *, const char *> m_lock_names{};
+
+  // Serializes detection passes (scratch state below is shared).
+  std::mutex m_run_mutex;
+
+  // Waiters enqueued in a ParkingLot, as seen by the current pass.
+  std::vector<std::pair<thread_id_t, WaiterInfo>> m_waiters_snapshot{};
 
-  std::unordered_map<thread_id_t, WaiterInfo> m_waiters{};
-  std::unordered_map<const Mutex *, thread_id_t> m_holders{};
+  // Valid entries of the waiter and holder tables are stamped with the
+  // current generation.
+  std::uint32_t m_generation = 0;
+  std::vector<WaiterEntry> m_waiters{};
+  HolderTable m_holders{};
+  std::vector<thread_id_t> m_holder_tids{};
+
+  // Wait-for graph, indexed by vertex (see build_wait_for_graph)
+  std::vector<thread_id_t> m_vertex_tids{};
+  std::vector<std::size_t> m_edge_offsets{};
+  std::vector<vertex_t> m_edges{};
+
+  // Tarjan's SCC state
+  std::vector<vertex_t> m_index{};
+  std::vector<vertex_t> m_lowlink{};
+  std::bitset<ThreadRegistry::MAX_THREADS> m_on_stack{};
+  std::vector<vertex_t> m_scc_stack{};
+  std::vector<TarjanFrame> m_call_stack{};
+
+  // Lockcycles found by the last pass
+  std::vector<thread_id_t> m_cycle_members{};
+  std::vector<std::size_t> m_cycle_offsets{};
+
+  // Lockcycle being broken, as seen by VictimPolicy
+  std::vector<DeadlockCycleMember> m_victim_candidates{};
+
+  // Report of the lockcycle being broken, and the ones broken so far
+  DeadlockReport m_report{};
+  DeadlockReportRing m_reports{};
 };
+
+// Helper for implementing DeadlockSafeLockType, for locks whose waiters park
+// on `parkinglot`. WaitNodeDataType must have following members
+//   ThreadRegistry::thread_id_t get_waiter_id();
+//   WaitToken get_wait_token();
+template <typename WaitNodeDataType>
+bool unpark_waiter(sync_prim::ParkingLot<WaitNodeDataType> &parkinglot,
+                   const void *lock, ThreadRegistry::thread_id_t tid,
+                   DeadlockDetector::WaitToken wait_token) {
+  bool unparked = false;
+
+  parkinglot.unpark(lock, [&](const WaitNodeDataType &waitdata) {
+    if (waitdata.get_waiter_id() == tid) {
+      if (waitdata.get_wait_token() == wait_token) {
+        DeadlockDetector::Instance.mark_dead_locked(tid);
+        unparked = true;
+        return UnparkControl::RemoveBreak;
+      }
+
+      return UnparkControl::RetainBreak;
+    }
+
+    return UnparkControl::RetainContinue;
+  });
+
+  return unparked;
+}
 } // namespace detail
-} // namespace sync_prim
\ No newline at end of file
+
+// Detect and break deadlocks among all the deadlock-safe locks, whatever
+// their type. Returns # deadlocks broken.
+int detect_deadlocks();
+
+// Run deadlock detection in the background (see DeadlockDetectionService).
+bool start_deadlock_detection(DeadlockDetectionOptions options = {});
+void stop_deadlock_detection();
+
+// Policy used to select the waiter to abort in each lockcycle.
+void set_deadlock_victim_policy(VictimPolicy policy);
+
+// Priority and cost of the calling thread, as reported to the VictimPolicy.
+void set_deadlock_priority(int priority);
+void set_deadlock_cost(std::uint64_t cost);
+
+// Name `lock` in the DeadlockReports, `name` must outlive it. A named lock
+// must be unnamed (by passing nullptr) before it's destroyed.
+void set_deadlock_lock_name(const void *lock, const char *name);
+
+// Sink to be called with the report of every deadlock broken (optional).
+void set_deadlock_report_sink(DeadlockReportSink sink);
+
+// Append the most recent reports with id > `after_id` to `reports`, reports
+// are kept in a ring, so old ones are lost if not scraped in time.
+// Returns the id to be passed to the next call.
+std::uint64_t scrape_deadlock_reports(std::uint64_t after_id,
+                                      std::vector<DeadlockReport> &reports);
+} // namespace sync_prim
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "sync_prim/ThreadRegistry.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace sync_prim {
+// Lockcycle broken by the DeadlockDetector.
+// Fixed size, so that it can be published into a lock-free ring (see
+// scrape_deadlock_reports).
+struct DeadlockReport {
+  using thread_id_t = ThreadRegistry::thread_id_t;
+
+  static constexpr std::size_t MAX_WAITERS = 16;
+  static constexpr std::size_t MAX_HELD_LOCKS = 8;
+
+  struct Waiter {
+    thread_id_t tid;
+    // Holder of `lock`, which is also part of the lockcycle.
+    thread_id_t holder;
+    const void *lock;
+    // See set_deadlock_lock_name, nullptr if the lock isn't named.
+    const char *lock_name;
+    const char *lock_type;
+    std::chrono::nanoseconds wait_duration;
+    // # deadlock-safe locks held, only up to MAX_HELD_LOCKS of them are
+    // recorded in `held_locks` (the rest of which are nullptr).
+    std::uint32_t num_held_locks;
+    std::array<const void *, MAX_HELD_LOCKS> held_locks;
+  };
+
+  // Sequence # of the report, starts from 1.
+  std::uint64_t id;
+  std::chrono::steady_clock::time_point detected_at;
+  // Waiter aborted with MutexLockResult::DEADLOCKED.
+  thread_id_t victim;
+  // # waiters in the lockcycle, only the first MAX_WAITERS of them are
+  // recorded in `waiters`.
+  std::uint32_t num_waiters;
+  std::array<Waiter, MAX_WAITERS> waiters;
+};
+
+// Called with every deadlock broken, from the thread running the detector.
+using DeadlockReportSink = void (*)(const DeadlockReport &report);
+
+namespace detail {
+// Ring of the most recent DeadlockReports. There is a single writer (the
+// detector, whose passes are serialized), while any # of readers may scrape
+// the ring concurrently. Every slot is protected by a seqlock, so neither
+// side ever blocks the other, and a reader simply skips the reports
+// overwritten while being read.
+class DeadlockReportRing {
+public:
+  static constexpr std::size_t SIZE = 64;
+
+  void publish(DeadlockReport &report);
+
+  // Append the reports with id > `after_id` to `reports`.
+  // Returns the id of the last report appended, `after_id` if none.
+  std::uint64_t scrape(std::uint64_t after_id,
+                       std::vector<DeadlockReport> &reports) const;
+
+private:
+  static_assert(std::is_trivially_copyable_v<DeadlockReport>);
+
+  static constexpr std::size_t NUM_WORDS =
+      (sizeof(DeadlockReport) + sizeof(std::uint64_t) - 1) /
+      sizeof(std::uint64_t);
+
+  struct Slot {
+    // Odd while the report is being written.
+    std::atomic<std::uint64_t> seq{0};
+    std::array<std::atomic<std::uint64_t>, NUM_WORDS> words{};
+  };
+
+  bool read(const Slot &slot, DeadlockReport &report) const;
+
+  std::atomic<std::uint64_t> m_last_id{0};
+  std::array<Slot, SIZE> m_slots{};
+};
+} // namespace detail
+} // namespace sync_prim
@@ -2,6 +2,7 @@
 
 #include "common.h"
 
+#include <climits>
 #include <utility>
 
 namespace sync_prim {
@@ -30,24 +31,19 @@ public:
   }
 
   bool try_lock() {
-    auto word = m_word.load();
-
-    // Other threads may not have decremented num waiters,
-    // so don't reset num_waiters.
-
-    if (!word.is_locked() &&
-        m_word.compare_exchange_strong(word, word.get_lock_word())) {
-      assert(!word.has_wait_until_free());
-      return true;
+    if (!try_acquire()) {
+      SYNC_PRIM_TRACE(trace::TRY_LOCK_FAILED, this);
+      return false;
     }
 
-    return false;
+    lock_acquired();
+    return true;
   }
 
   MutexLockResult lock() {
     constexpr bool NORMAL_LOCK = false;
     while (true) {
-      if (try_lock())
+      if (try_acquire())
         break;
 
       _mm_pause();
@@ -59,6 +55,7 @@ public:
 
       case PARKRES_LOCKED:
         assert(is_locked_by_me());
+        lock_acquired();
         return MutexLockResult::LOCKED;
 
       case PARKRES_DEADLOCKED:
@@ -68,6 +65,7 @@ public:
     }
 
     assert(is_locked_by_me());
+    lock_acquired();
     return MutexLockResult::LOCKED;
   }
 
@@ -81,7 +79,7 @@ public:
   MutexLockResult lock_or_wait() {
     constexpr bool WAITED_UNTIL_FREE = true;
     while (true) {
-      if (try_lock())
+      if (try_acquire())
         break;
 
       _mm_pause();
@@ -105,12 +103,18 @@ public:
     }
 
     assert(is_locked_by_me());
+    lock_acquired();
     return MutexLockResult::LOCKED;
   }
 
   void unlock() {
     bool retry = true;
 
+    SYNC_PRIM_TRACE(trace::LOCK_RELEASED, this);
+
+    if constexpr (EnableDeadlockDetection)
+      DeadlockDetector::Instance.lock_released(this);
+
     while (retry) {
       auto word = m_word.load();
 
@@ -129,19 +133,28 @@ public:
   template <typename Dummy = void,
             typename = typename std::enable_if_t<DEADLOCK_SAFE, Dummy>>
   static int detect_deadlocks() {
-    int num_deadlocks = 0;
+    return sync_prim::detect_deadlocks();
+  }
 
-    while (deadlock_detector.run(parkinglot))
-      num_deadlocks++;
+  // Run deadlock detection in the background (see DeadlockDetectionService).
+  template <typename Dummy = void,
+            typename = typename std::enable_if_t<DEADLOCK_SAFE, Dummy>>
+  static bool
+  start_deadlock_detection(DeadlockDetectionOptions options = {}) {
+    return sync_prim::start_deadlock_detection(options);
+  }
 
-    return num_deadlocks;
+  template <typename Dummy = void,
+            typename = typename std::enable_if_t<DEADLOCK_SAFE, Dummy>>
+  static void stop_deadlock_detection() {
+    sync_prim::stop_deadlock_detection();
   }
 
 private:
-  using DeadlockDetector =
-      sync_prim::detail::DeadlockDetector<std::conditional_t<
-          EnableDeadlockDetection, FairMutexImpl, sync_prim::detail::empty_t>>;
-  using WaitToken = typename DeadlockDetector::WaitToken;
+  using DeadlockDetector = sync_prim::detail::DeadlockDetector;
+  using WaitToken =
+      std::conditional_t<EnableDeadlockDetection, DeadlockDetector::WaitToken,
+                         sync_prim::detail::empty_t>;
 
   struct WaitNodeData {
     const FairMutexImpl *m;
@@ -150,18 +163,22 @@ private:
     WaitToken wait_token;
 
     thread_id_t get_waiter_id() const { return tid; }
-    thread_id_t get_wait_token() const { return wait_token; }
+    WaitToken get_wait_token() const { return wait_token; }
   };
 
-  class alignas(std::uint64_t) LockWord {
+  // # waiters can't exceed # threads, so it's as wide as a tid, which keeps
+  // the lock word at twice the size of a tid (see SYNC_PRIM_TID_BITS).
+  using waiters_t = thread_id_t;
+
+  class alignas(2 * sizeof(thread_id_t)) LockWord {
   public:
     thread_id_t holder;
-    std::uint32_t num_waiters;
+    waiters_t num_waiters;
 
   private:
-    using u32Bits = detail::Bits<std::uint32_t>;
-    static constexpr auto INVALID_HOLDER = ThreadRegistry::MAX_THREADS;
-    static constexpr auto WAIT_UNTIL_FREE_BIT = 31;
+    using WaitersBits = detail::Bits<waiters_t>;
+    static constexpr thread_id_t INVALID_HOLDER = ThreadRegistry::MAX_THREADS;
+    static constexpr int WAIT_UNTIL_FREE_BIT = sizeof(waiters_t) * CHAR_BIT - 1;
 
   public:
     static LockWord get_init_word() { return {INVALID_HOLDER, 0}; }
@@ -174,42 +191,69 @@ private:
 
     bool has_waiters() const { return num_waiters != 0; }
     bool has_wait_until_free() const {
-      return u32Bits ::IsAllSet(num_waiters, WAIT_UNTIL_FREE_BIT);
+      return WaitersBits::IsAllSet(num_waiters, WAIT_UNTIL_FREE_BIT);
     }
 
     LockWord get_lock_word() {
       return {ThreadRegistry::ThreadID(),
-              u32Bits ::Clear(num_waiters, WAIT_UNTIL_FREE_BIT)};
+              WaitersBits::Clear(num_waiters, WAIT_UNTIL_FREE_BIT)};
     }
 
     LockWord get_unlocked_word() {
       return {INVALID_HOLDER,
-              u32Bits ::Clear(num_waiters, WAIT_UNTIL_FREE_BIT)};
+              WaitersBits::Clear(num_waiters, WAIT_UNTIL_FREE_BIT)};
     }
 
     LockWord transfer_lock(thread_id_t tid) const {
-      return {tid, u32Bits ::Clear(num_waiters, WAIT_UNTIL_FREE_BIT) - 1};
+      auto others = WaitersBits::Clear(num_waiters, WAIT_UNTIL_FREE_BIT);
+
+      return {tid, static_cast<waiters_t>(others - 1)};
     }
 
     LockWord increment_num_waiters() const {
       return {holder,
-              u32Bits ::MaskedOp(
+              WaitersBits::MaskedOp(
                   num_waiters, [](auto num_waiters) { return num_waiters + 1; },
                   WAIT_UNTIL_FREE_BIT)};
     }
 
     LockWord decrement_num_waiters() const {
       return {holder,
-              u32Bits ::MaskedOp(
+              WaitersBits::MaskedOp(
                   num_waiters, [](auto num_waiters) { return num_waiters - 1; },
                   WAIT_UNTIL_FREE_BIT)};
     }
 
     LockWord set_wait_until_free() const {
-      return {holder, u32Bits ::Set(num_waiters, WAIT_UNTIL_FREE_BIT)};
+      return {holder, WaitersBits::Set(num_waiters, WAIT_UNTIL_FREE_BIT)};
     }
   };
 
+  static_assert(sizeof(LockWord) == 2 * sizeof(thread_id_t),
+                "FairMutex's lock word must stay two tids wide");
+
+  bool try_acquire() {
+    auto word = m_word.load();
+
+    // Other threads may not have decremented num waiters,
+    // so don't reset num_waiters.
+
+    if (!word.is_locked() &&
+        m_word.compare_exchange_strong(word, word.get_lock_word())) {
+      assert(!word.has_wait_until_free());
+      return true;
+    }
+
+    return false;
+  }
+
+  void lock_acquired() {
+    SYNC_PRIM_TRACE(trace::LOCK_ACQUIRED, this);
+
+    if constexpr (EnableDeadlockDetection)
+      DeadlockDetector::Instance.lock_acquired(this);
+  }
+
   bool increment_num_waiters() {
     while (true) {
       auto word = m_word.load();
@@ -236,6 +280,8 @@ private:
   }
 
   void transfer_lock(thread_id_t tid) {
+    SYNC_PRIM_TRACE(trace::HANDOFF, this, tid);
+
     while (true) {
       auto word = m_word.load();
 
@@ -264,12 +310,34 @@ private:
     return word.is_locked() && word.has_waiters();
   }
 
+  static DeadlockDetector::lock_type_id_t deadlock_lock_type() {
+    static const sync_prim::detail::DeadlockSafeLockType lock_type{
+        "FairDeadlockSafeMutex",
+        [](const void *lock, std::vector<thread_id_t> &holders) {
+          auto *m = static_cast<const FairMutexImpl *>(lock);
+
+          if (auto holder = m->get_holder())
+            holders.push_back(*holder);
+        },
+        [](const void *lock, thread_id_t tid, WaitToken wait_token) {
+          return sync_prim::detail::unpark_waiter(parkinglot, lock, tid,
+                                                  wait_token);
+        }};
+    static const auto lock_type_id =
+        DeadlockDetector::register_lock_type(&lock_type);
+
+    return lock_type_id;
+  }
+
   template <bool WaitUntilFree> auto do_park() -> std::pair<ParkResult, bool> {
     auto park_cond = [&]() {
       if (should_wait()) {
         if constexpr (WaitUntilFree)
           set_wait_until_free();
 
+        if constexpr (EnableDeadlockDetection)
+          DeadlockDetector::Instance.mark_enqueued();
+
         return true;
       }
 
@@ -277,12 +345,13 @@ private:
     };
 
     if constexpr (EnableDeadlockDetection) {
-      auto wait_token = deadlock_detector.init_park(this);
+      auto wait_token =
+          DeadlockDetector::Instance.init_park(this, deadlock_lock_type());
       WaitNodeData waitdata{this, ThreadRegistry::ThreadID(), WaitUntilFree,
                             wait_token};
 
       auto res = parkinglot.park(this, waitdata, park_cond, []() {});
-      bool is_dead_locked = deadlock_detector.fini_park();
+      bool is_dead_locked = DeadlockDetector::Instance.fini_park();
 
       if (is_dead_locked)
         decrement_num_waiters();
@@ -379,7 +448,6 @@ private:
   }
 
   static inline auto parkinglot = sync_prim::ParkingLot<WaitNodeData>{};
-  static inline auto deadlock_detector = DeadlockDetector{};
 
   std::atomic<LockWord> m_word{LockWord::get_init_word()};
 };
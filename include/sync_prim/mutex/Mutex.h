@@ -33,15 +33,19 @@ public:
   }
 
   bool try_lock() {
-    auto word = LockWord::get_unlocked_word();
+    if (!try_acquire()) {
+      SYNC_PRIM_TRACE(trace::TRY_LOCK_FAILED, this);
+      return false;
+    }
 
-    return m_word.compare_exchange_strong(word, LockWord::get_lock_word());
+    lock_acquired();
+    return true;
   }
 
   bool is_locked() const { return m_word.load().is_locked(); }
 
   MutexLockResult lock() {
-    while (!try_lock()) {
+    while (!try_acquire()) {
       if (!uncontended_path_available())
         return lock_contended();
 
@@ -49,11 +53,17 @@ public:
     }
 
     assert(is_locked());
+    lock_acquired();
 
     return MutexLockResult::LOCKED;
   }
 
   void unlock() {
+    SYNC_PRIM_TRACE(trace::LOCK_RELEASED, this);
+
+    if constexpr (EnableDeadlockDetection)
+      DeadlockDetector::Instance.lock_released(this);
+
     auto word = m_word.exchange(LockWord::get_unlocked_word());
 
     if (word.is_lock_contented()) {
@@ -67,19 +77,28 @@ public:
   template <typename Dummy = void,
             typename = typename std::enable_if_t<DEADLOCK_SAFE, Dummy>>
   static int detect_deadlocks() {
-    int num_deadlocks = 0;
+    return sync_prim::detect_deadlocks();
+  }
 
-    while (deadlock_detector.run(parkinglot))
-      num_deadlocks++;
+  // Run deadlock detection in the background (see DeadlockDetectionService).
+  template <typename Dummy = void,
+            typename = typename std::enable_if_t<DEADLOCK_SAFE, Dummy>>
+  static bool
+  start_deadlock_detection(DeadlockDetectionOptions options = {}) {
+    return sync_prim::start_deadlock_detection(options);
+  }
 
-    return num_deadlocks;
+  template <typename Dummy = void,
+            typename = typename std::enable_if_t<DEADLOCK_SAFE, Dummy>>
+  static void stop_deadlock_detection() {
+    sync_prim::stop_deadlock_detection();
   }
 
 private:
-  using DeadlockDetector =
-      sync_prim::detail::DeadlockDetector<std::conditional_t<
-          EnableDeadlockDetection, MutexImpl, sync_prim::detail::empty_t>>;
-  using WaitToken = typename DeadlockDetector::WaitToken;
+  using DeadlockDetector = sync_prim::detail::DeadlockDetector;
+  using WaitToken =
+      std::conditional_t<EnableDeadlockDetection, DeadlockDetector::WaitToken,
+                         sync_prim::detail::empty_t>;
 
   struct BasicWaitNodeData {
     const MutexImpl *m;
@@ -91,7 +110,7 @@ private:
     WaitToken wait_token;
 
     thread_id_t get_waiter_id() const { return tid; }
-    thread_id_t get_wait_token() const { return wait_token; }
+    WaitToken get_wait_token() const { return wait_token; }
   };
 
   class LockWord {
@@ -105,6 +124,9 @@ private:
     static constexpr thread_id_t M_UNLOCKED =
         TidBits::Clear(INVALID_THREADID, CONTENTED_BIT);
 
+    static_assert(ThreadRegistry::MAX_THREADS < M_UNLOCKED,
+                  "a tid must never look like the unlocked word");
+
   public:
     using WordType =
         std::conditional_t<EnableDeadlockDetection, thread_id_t, LockState>;
@@ -155,16 +177,55 @@ private:
     }
   };
 
+  bool try_acquire() {
+    auto word = LockWord::get_unlocked_word();
+
+    return m_word.compare_exchange_strong(word, LockWord::get_lock_word());
+  }
+
+  void lock_acquired() {
+    SYNC_PRIM_TRACE(trace::LOCK_ACQUIRED, this);
+
+    if constexpr (EnableDeadlockDetection)
+      DeadlockDetector::Instance.lock_acquired(this);
+  }
+
+  static DeadlockDetector::lock_type_id_t deadlock_lock_type() {
+    static const sync_prim::detail::DeadlockSafeLockType lock_type{
+        "DeadlockSafeMutex",
+        [](const void *lock, std::vector<thread_id_t> &holders) {
+          if (auto holder = static_cast<const MutexImpl *>(lock)->get_holder())
+            holders.push_back(*holder);
+        },
+        [](const void *lock, thread_id_t tid, WaitToken wait_token) {
+          return sync_prim::detail::unpark_waiter(parkinglot, lock, tid,
+                                                  wait_token);
+        }};
+    static const auto lock_type_id =
+        DeadlockDetector::register_lock_type(&lock_type);
+
+    return lock_type_id;
+  }
+
   bool park() const {
     if constexpr (EnableDeadlockDetection) {
-      auto wait_token = deadlock_detector.init_park(this);
+      auto wait_token =
+          DeadlockDetector::Instance.init_park(this, deadlock_lock_type());
       AdvancedWaitNodeData waitdata{this, ThreadRegistry::ThreadID(),
                                     wait_token};
 
       parkinglot.park(
-          this, waitdata, [&]() { return is_lock_contented(); }, []() {});
+          this, waitdata,
+          [&]() {
+            if (!is_lock_contented())
+              return false;
+
+            DeadlockDetector::Instance.mark_enqueued();
+            return true;
+          },
+          []() {});
 
-      auto is_dead_locked = deadlock_detector.fini_park();
+      auto is_dead_locked = DeadlockDetector::Instance.fini_park();
       return is_dead_locked;
     } else {
       parkinglot.park(
@@ -184,8 +245,11 @@ private:
       if (!old.is_locked())
         return true;
 
-      if (old.is_lock_contented() ||
-          m_word.compare_exchange_strong(old, old.get_contented_word())) {
+      if (old.is_lock_contented())
+        return false;
+
+      if (m_word.compare_exchange_strong(old, old.get_contented_word())) {
+        SYNC_PRIM_TRACE(trace::CONTENDED, this);
         return false;
       }
 
@@ -205,13 +269,13 @@ private:
         return MutexLockResult::DEADLOCKED;
     };
 
+    lock_acquired();
     return MutexLockResult::LOCKED;
   }
 
   static inline auto parkinglot =
       ParkingLot<std::conditional_t<EnableDeadlockDetection,
                                     AdvancedWaitNodeData, BasicWaitNodeData>>{};
-  static inline auto deadlock_detector = DeadlockDetector{};
 
   std::atomic<LockWord> m_word{LockWord::get_unlocked_word()};
 };
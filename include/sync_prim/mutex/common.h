@@ -3,6 +3,7 @@
 #include "DeadlockDetector.h"
 #include "sync_prim/ParkingLot.h"
 #include "sync_prim/ThreadRegistry.h"
+#include "sync_prim/Trace.h"
 
 #include <array>
 #include <atomic>
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "sync_prim/ParkingLot.h"
+#include "sync_prim/ThreadSlots.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace sync_prim {
+namespace reclamation {
+// Epoch based reclamation (EBR).
+//
+// Readers announce the global epoch in their ThreadSlots slot on `enter`, and
+// clear it on `exit`, so a read-side critical region costs a couple of stores
+// to a thread local cache line, and never takes a lock.
+//
+// Objects unlinked from a shared structure are `retire`d, stamped with the
+// global epoch. The epoch only advances once every reader inside a critical
+// region has announced the current epoch (found by scanning tids up to
+// MaxThreadID()). So once the epoch is 2 past the stamp, no reader can still
+// hold a reference, and the object is freed.
+//
+// Retired objects are reclaimed in batches by the retiring thread. Objects
+// retired by a thread, which exits before they are reclaimed, are reclaimed by
+// the next owner of its tid, or with the domain.
+class EpochDomain {
+public:
+  using Deleter = void (*)(void *ptr);
+
+  // # objects retired by a thread, before it attempts reclamation.
+  static constexpr std::size_t RECLAIM_BATCH_SIZE = 64;
+
+  EpochDomain() : m_records{&ThreadRecord::reset} {}
+  EpochDomain(const EpochDomain &) = delete;
+
+  // Begin / end a read-side critical region, regions may be nested.
+  void enter();
+  void exit();
+
+  // Free `ptr` using `deleter`, once no reader could be referencing it.
+  // `ptr` must already be unreachable for new readers.
+  void retire(void *ptr, Deleter deleter);
+
+  template <typename T> void retire(T *ptr) {
+    retire(ptr, [](void *p) { delete static_cast<T *>(p); });
+  }
+
+  // Wait for all critical regions active at the time of call to exit, then
+  // reclaim the objects retired by the calling thread. Parks (instead of
+  // spinning) while the readers are holding back the epoch.
+  // Must not be called from within a critical region.
+  void synchronize();
+
+  // Advance the epoch, if all active readers have observed it.
+  bool try_advance();
+
+  std::uint64_t epoch() const { return m_epoch.load(); }
+
+  class Guard {
+  public:
+    explicit Guard(EpochDomain &domain) : m_domain(domain) { m_domain.enter(); }
+    Guard(const Guard &) = delete;
+    ~Guard() { m_domain.exit(); }
+
+  private:
+    EpochDomain &m_domain;
+  };
+
+private:
+  struct Retired {
+    void *ptr;
+    Deleter deleter;
+    std::uint64_t epoch;
+  };
+
+  struct ThreadRecord {
+    ThreadRecord() = default;
+    ThreadRecord(const ThreadRecord &) = delete;
+
+    // Reclaims the objects left behind, when the domain is destroyed.
+    ~ThreadRecord() {
+      for (const auto &retired : retired)
+        retired.deleter(retired.ptr);
+    }
+
+    // Retired objects are kept, to be reclaimed by the next owner.
+    static void reset(ThreadRecord &record) {
+      record.announcement = 0;
+      record.depth = 0;
+    }
+
+    // (epoch << 1) | 1, while inside a critical region, 0 otherwise.
+    std::atomic<std::uint64_t> announcement{0};
+    // Only accessed by the owner
+    std::uint32_t depth = 0;
+    std::vector<Retired> retired;
+  };
+
+  // Returns true, if an active reader hasn't observed `epoch` yet.
+  bool is_epoch_held_back(std::uint64_t epoch);
+  void reclaim(ThreadRecord &record);
+
+  std::atomic<std::uint64_t> m_epoch{0};
+  // # threads parked in synchronize()
+  std::atomic<std::uint32_t> m_num_synchronizers{0};
+  ThreadSlots<ThreadRecord> m_records;
+
+  static inline auto parkinglot = ParkingLot<>{};
+};
+} // namespace reclamation
+} // namespace sync_prim
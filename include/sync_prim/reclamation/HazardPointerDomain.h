@@ -0,0 +1,136 @@
+#pragma once
+
+#include "sync_prim/ThreadSlots.h"
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace sync_prim {
+namespace reclamation {
+// Hazard pointers.
+//
+// Every registered thread owns HAZARDS_PER_THREAD hazard slots (in its
+// ThreadSlots slot), accessed through a Holder. A reader publishes the
+// pointer it's about to dereference in one of them, and re-validates that
+// it's still reachable. Unlike
+// EpochDomain, a stalled reader only holds back the objects it's protecting,
+// so the memory waiting to be reclaimed stays bounded.
+//
+// Retired objects are kept per thread. Once a thread has retired as many
+// objects as there could be hazards (over tids [0, MaxThreadID()]), it scans
+// all the hazards and frees the objects not protected, so the cost of a scan
+// is amortized over the retires.
+class HazardPointerDomain {
+public:
+  using Deleter = void (*)(void *ptr);
+
+  static constexpr std::size_t HAZARDS_PER_THREAD = 4;
+
+  // Minimum # objects retired by a thread, before it scans.
+  static constexpr std::size_t RECLAIM_BATCH_SIZE = 64;
+
+  HazardPointerDomain() : m_records{&ThreadRecord::reset} {}
+  HazardPointerDomain(const HazardPointerDomain &) = delete;
+
+  // Hazard slots of the calling thread, looked up once, so that protecting
+  // a pointer is a store and a fence. Must be used only by the thread which
+  // constructed it, and the thread mustn't unregister meanwhile. Clears its
+  // hazards when destroyed.
+  class Holder {
+  public:
+    explicit Holder(HazardPointerDomain &domain)
+        : m_hazards(domain.m_records.local().hazards.data()) {}
+    Holder(const Holder &) = delete;
+
+    ~Holder() {
+      for (std::size_t index = 0; index < HAZARDS_PER_THREAD; index++)
+        clear(index);
+    }
+
+    // Load `src`, and protect the loaded pointer in hazard slot `index`.
+    template <typename T>
+    T *protect(std::size_t index, const std::atomic<T *> &src) {
+      auto &hazard = hazard_slot(index);
+      T *ptr = src.load(std::memory_order_relaxed);
+
+      while (true) {
+        hazard.store(ptr, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        T *current = src.load(std::memory_order_acquire);
+
+        if (current == ptr)
+          return ptr;
+
+        ptr = current;
+      }
+    }
+
+    // Protect `ptr` in hazard slot `index`, the caller must re-validate that
+    // `ptr` is still reachable, before dereferencing it.
+    void set(std::size_t index, const void *ptr) {
+      hazard_slot(index).store(ptr, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void clear(std::size_t index) {
+      hazard_slot(index).store(nullptr, std::memory_order_release);
+    }
+
+  private:
+    std::atomic<const void *> &hazard_slot(std::size_t index) {
+      assert(index < HAZARDS_PER_THREAD);
+      return m_hazards[index];
+    }
+
+    std::atomic<const void *> *const m_hazards;
+  };
+
+  // Free `ptr` using `deleter`, once no hazard pointer protects it.
+  // `ptr` must already be unreachable for new readers.
+  void retire(void *ptr, Deleter deleter);
+
+  template <typename T> void retire(T *ptr) {
+    retire(ptr, [](void *p) { delete static_cast<T *>(p); });
+  }
+
+  // Free the objects retired by the calling thread, which aren't protected.
+  void reclaim();
+
+private:
+  struct Retired {
+    void *ptr;
+    Deleter deleter;
+  };
+
+  struct ThreadRecord {
+    ThreadRecord() = default;
+    ThreadRecord(const ThreadRecord &) = delete;
+
+    // Reclaims the objects left behind, when the domain is destroyed.
+    ~ThreadRecord() {
+      for (const auto &retired : retired)
+        retired.deleter(retired.ptr);
+    }
+
+    // Retired objects are kept, to be reclaimed by the next owner.
+    static void reset(ThreadRecord &record) {
+      for (auto &hazard : record.hazards)
+        hazard = nullptr;
+    }
+
+    std::array<std::atomic<const void *>, HAZARDS_PER_THREAD> hazards{};
+    // Only accessed by the owner
+    std::vector<Retired> retired;
+    std::vector<const void *> protected_ptrs;
+  };
+
+  void reclaim(ThreadRecord &record);
+
+  ThreadSlots<ThreadRecord> m_records;
+};
+} // namespace reclamation
+} // namespace sync_prim
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "sync_prim/ParkingLot.h"
+#include "sync_prim/ThreadSlots.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sync_prim {
+namespace reclamation {
+// Userspace RCU, for read-mostly data (config, routing tables, ...).
+//
+// A read-side critical region only stores a snapshot of the grace period
+// counter in the reader's ThreadSlots slot, and clears it on exit.
+// `synchronize` starts a new grace period (by bumping the counter), and waits
+// for the readers holding an older snapshot to exit, parking on a ParkingLot
+// meanwhile. Concurrent synchronizers share grace periods.
+//
+// `call` queues a callback to be run after a grace period. Callbacks are run
+// by a background thread (started on first use), which waits for a single
+// grace period for all the callbacks queued so far, so that many updaters
+// are batched into one grace period.
+class RcuDomain {
+public:
+  using Callback = void (*)(void *arg);
+
+  RcuDomain() : m_readers{&ReaderRecord::reset} {}
+  RcuDomain(const RcuDomain &) = delete;
+
+  // Runs the pending callbacks, and stops the background thread.
+  ~RcuDomain();
+
+  // Read-side critical region, regions may be nested.
+  void read_lock();
+  void read_unlock();
+
+  // Wait for all read-side critical regions active at the time of call to
+  // exit. Must not be called from within a critical region.
+  void synchronize();
+
+  // Run `callback(arg)` (on the background thread), after a grace period.
+  void call(Callback callback, void *arg);
+
+  template <typename T> void retire(T *ptr) {
+    call([](void *p) { delete static_cast<T *>(p); }, ptr);
+  }
+
+  // Wait for all the callbacks queued so far to run.
+  void barrier();
+
+  class ReadGuard {
+  public:
+    explicit ReadGuard(RcuDomain &domain) : m_domain(domain) {
+      m_domain.read_lock();
+    }
+    ReadGuard(const ReadGuard &) = delete;
+    ~ReadGuard() { m_domain.read_unlock(); }
+
+  private:
+    RcuDomain &m_domain;
+  };
+
+  static RcuDomain Instance;
+
+private:
+  struct ReaderRecord {
+    static void reset(ReaderRecord &record) {
+      record.snapshot = 0;
+      record.depth = 0;
+    }
+
+    // Grace period counter, when the region was entered, 0 outside of one.
+    std::atomic<std::uint64_t> snapshot{0};
+    // Only accessed by the owner
+    std::uint32_t depth = 0;
+  };
+
+  struct PendingCallback {
+    Callback callback;
+    void *arg;
+  };
+
+  // Returns true, if a reader entered its region before `grace_period`.
+  bool has_readers_before(std::uint64_t grace_period);
+  void worker();
+
+  std::atomic<std::uint64_t> m_grace_period{1};
+  // # threads parked in synchronize()
+  std::atomic<std::uint32_t> m_num_synchronizers{0};
+  ThreadSlots<ReaderRecord> m_readers;
+
+  // call() queue, and its background thread
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  std::thread m_thread;
+  bool m_stop = false;
+  std::vector<PendingCallback> m_callbacks;
+  std::uint64_t m_num_queued = 0;
+  std::uint64_t m_num_completed = 0;
+
+  static inline auto parkinglot = ParkingLot<>{};
+};
+
+inline void rcu_read_lock() { RcuDomain::Instance.read_lock(); }
+inline void rcu_read_unlock() { RcuDomain::Instance.read_unlock(); }
+inline void synchronize_rcu() { RcuDomain::Instance.synchronize(); }
+inline void rcu_barrier() { RcuDomain::Instance.barrier(); }
+
+inline void call_rcu(RcuDomain::Callback callback, void *arg) {
+  RcuDomain::Instance.call(callback, arg);
+}
+} // namespace reclamation
+} // namespace sync_prim
@@ -0,0 +1,167 @@
+#include "sync_prim/mutex/DeadlockDetectionService.h"
+
+#include <algorithm>
+
+namespace sync_prim {
+namespace detail {
+DeadlockDetectionService::DeadlockDetectionService(Hooks hooks)
+    : m_hooks(hooks) {}
+
+DeadlockDetectionService::~DeadlockDetectionService() { stop(); }
+
+bool DeadlockDetectionService::start(Options options) {
+  std::lock_guard<std::mutex> lock{m_mutex};
+
+  if (m_running)
+    return false;
+
+  m_options = options;
+  m_running = true;
+  m_stop = false;
+  m_waiter_parked = false;
+  m_num_deadlocks = 0;
+  m_thread = std::thread{[this]() { worker(); }};
+
+  return true;
+}
+
+void DeadlockDetectionService::stop() {
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+
+    if (!m_running)
+      return;
+
+    m_stop = true;
+  }
+
+  m_cond.notify_all();
+  m_thread.join();
+
+  std::lock_guard<std::mutex> lock{m_mutex};
+  m_running = false;
+}
+
+bool DeadlockDetectionService::is_running() const {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  return m_running;
+}
+
+void DeadlockDetectionService::notify_waiter_parked() {
+  if (!m_dormant.load(std::memory_order_relaxed))
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+
+    if (!m_running || m_waiter_parked)
+      return;
+
+    m_waiter_parked = true;
+  }
+
+  m_cond.notify_all();
+}
+
+int DeadlockDetectionService::num_deadlocks() const {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  return m_num_deadlocks;
+}
+
+std::chrono::milliseconds
+DeadlockDetectionService::poll_interval(std::chrono::milliseconds backoff,
+                                        std::size_t num_waiters) const {
+  std::size_t steps = 1 + num_waiters / std::max<std::size_t>(
+                                             m_options.waiters_per_poll_step, 1);
+
+  // Result is clamped to `max_poll_interval` anyway, bound the # steps
+  // likewise, so a large # waiters can't overflow.
+  if (backoff.count() > 0)
+    steps = std::min<std::size_t>(
+        steps, 1 + m_options.max_poll_interval / backoff);
+
+  return std::clamp(backoff * static_cast<long>(steps),
+                    m_options.min_poll_interval, m_options.max_poll_interval);
+}
+
+void DeadlockDetectionService::worker() {
+  std::unique_lock<std::mutex> lock{m_mutex};
+  TimePoint last_pass = TimePoint::min();
+  // Oldest waiter, as of the last pass.
+  TimePoint last_oldest = TimePoint::min();
+  // Interval, backed off by passes that found no deadlock.
+  auto backoff = m_options.min_poll_interval;
+
+  while (!m_stop) {
+    // Hooks scan the detector's wait records, don't hold our lock meanwhile.
+    m_waiter_parked = false;
+    lock.unlock();
+
+    Waiters waiters = m_hooks.parked_waiters(last_pass);
+
+    lock.lock();
+
+    if (waiters.count == 0) {
+      // Dormant until somebody parks. A waiter publishes its wait record
+      // before checking `m_dormant`, so either it sees `m_dormant`, or the
+      // recheck below sees the waiter.
+      m_dormant.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      lock.unlock();
+      waiters = m_hooks.parked_waiters(last_pass);
+      lock.lock();
+
+      if (waiters.count == 0)
+        m_cond.wait(lock, [this]() { return m_stop || m_waiter_parked; });
+
+      m_dormant.store(false, std::memory_order_relaxed);
+      continue;
+    }
+
+    if (waiters.oldest_wait_start != last_oldest)
+      backoff = m_options.min_poll_interval;
+
+    TimePoint next_pass = waiters.oldest_wait_start + m_options.timeout;
+
+    if (last_pass != TimePoint::min()) {
+      next_pass = std::max(next_pass,
+                           last_pass + poll_interval(backoff, waiters.count));
+
+      // Waiters which parked after the last pass, may be part of a new
+      // deadlock, don't leave them for a backed off interval.
+      if (waiters.oldest_new_wait_start != TimePoint::max()) {
+        next_pass = std::min(
+            next_pass,
+            std::max(waiters.oldest_new_wait_start + m_options.timeout,
+                     last_pass + m_options.min_poll_interval));
+      }
+    }
+
+    if (auto now = Clock::now(); now < next_pass) {
+      // Rescan at least every `timeout` meanwhile, to notice new waiters.
+      auto rescan = now + std::max(m_options.timeout,
+                                   m_options.min_poll_interval);
+
+      m_cond.wait_until(lock, std::min(next_pass, rescan),
+                        [this]() { return m_stop; });
+      continue;
+    }
+
+    lock.unlock();
+    // Waiters parking during the pass may not be seen by it, they're new to
+    // the next one.
+    last_pass = Clock::now();
+    int num_deadlocks = m_hooks.detect_deadlocks();
+    last_oldest = waiters.oldest_wait_start;
+    lock.lock();
+
+    m_num_deadlocks += num_deadlocks;
+
+    // More deadlocks may follow the ones broken, otherwise back off.
+    backoff = num_deadlocks != 0
+                  ? m_options.min_poll_interval
+                  : std::min(backoff * 2, m_options.max_poll_interval);
+  }
+}
+} // namespace detail
+} // namespace sync_prim
@@ -0,0 +1,498 @@
+#include "sync_prim/mutex/DeadlockDetector.h"
+#include "sync_prim/Trace.h"
+
+#include <algorithm>
+
+#include <folly/Hash.h>
+
+namespace sync_prim {
+namespace detail {
+DeadlockDetector DeadlockDetector::Instance;
+
+static std::mutex lock_types_mutex;
+static std::size_t num_lock_types = 0;
+
+DeadlockDetector::lock_type_id_t
+DeadlockDetector::register_lock_type(const DeadlockSafeLockType *lock_type) {
+  std::lock_guard<std::mutex> lock{lock_types_mutex};
+
+  assert(num_lock_types < MAX_LOCK_TYPES);
+
+  g_lock_types[num_lock_types] = lock_type;
+
+  return static_cast<lock_type_id_t>(num_lock_types++);
+}
+
+DeadlockDetector::WaitToken
+DeadlockDetector::init_park(const void *lock, lock_type_id_t lock_type) {
+  auto &thread_info = local_wait_info();
+  auto wait_token = thread_info.init_park({lock, lock_type});
+
+  // Wait record must be visible before checking, whether the service is
+  // dormant (pairs with the fence in DeadlockDetectionService::worker).
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  if (auto *service = m_service.load(std::memory_order_relaxed))
+    service->notify_waiter_parked();
+
+  return wait_token;
+}
+
+bool DeadlockDetector::fini_park() {
+  auto &thread_info = local_wait_info();
+
+  thread_info.fini_park();
+
+  return thread_info.is_dead_locked;
+}
+
+DeadlockDetectionService::Waiters
+DeadlockDetector::parked_waiters(TimePoint since) {
+  DeadlockDetectionService::Waiters waiters;
+
+  g_wait_infos->for_each([&](thread_id_t, ThreadWaitInfo &info) {
+    if (!info.waiting_on.load(std::memory_order_acquire))
+      return;
+
+    // Can be of the previous wait, if racing with `init_park`, which only
+    // makes the pass start a bit early.
+    TimePoint wait_start_time = info.wait_start_time;
+
+    if (waiters.count++ == 0 || wait_start_time < waiters.oldest_wait_start)
+      waiters.oldest_wait_start = wait_start_time;
+
+    if (wait_start_time > since)
+      waiters.oldest_new_wait_start =
+          std::min(waiters.oldest_new_wait_start, wait_start_time);
+  });
+
+  return waiters;
+}
+
+int DeadlockDetector::run() {
+  std::lock_guard<std::mutex> run_lock{m_run_mutex};
+  int num_deadlocks = 0;
+
+  gather_waiters_and_holders_info();
+  build_wait_for_graph();
+  detect_lock_cycles();
+
+  for (std::size_t i = 0; i + 1 < m_cycle_offsets.size(); i++) {
+    const thread_id_t *begin = m_cycle_members.data() + m_cycle_offsets[i];
+    const thread_id_t *end = m_cycle_members.data() + m_cycle_offsets[i + 1];
+
+    if (verify_lock_cycle(begin, end))
+      num_deadlocks++;
+  }
+
+  return num_deadlocks;
+}
+
+void DeadlockDetector::gather_waiters_and_holders_info() {
+  m_waiters_snapshot.clear();
+
+  g_wait_infos->for_each([&](thread_id_t tid, ThreadWaitInfo &info) {
+    if (auto record = read_wait_record(info))
+      m_waiters_snapshot.emplace_back(tid, *record);
+  });
+
+  next_generation();
+  m_vertex_tids.clear();
+  m_holder_tids.clear();
+  m_holders.reset(m_waiters_snapshot.size(), m_generation);
+
+  for (const auto &[waiter_id, record] : m_waiters_snapshot) {
+    TypedLock lock = record.lock;
+
+    if (!m_holders.find(lock.lock())) {
+      auto first = static_cast<std::uint32_t>(m_holder_tids.size());
+
+      lock.type()->get_holders(lock.lock(), m_holder_tids);
+      m_holders.insert(
+          lock.lock(),
+          {first, static_cast<std::uint32_t>(m_holder_tids.size() - first)});
+    }
+
+    add_waiter(waiter_id, record);
+  }
+}
+
+std::optional<DeadlockDetector::WaiterInfo>
+DeadlockDetector::read_wait_record(const ThreadWaitInfo &info) {
+  // Writers only hold the record for a few stores, but don't wait on a
+  // thread, which got preempted in the middle. It's being woken up anyway.
+  constexpr int MAX_ATTEMPTS = 16;
+
+  for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+    auto seq = info.seq.load(std::memory_order_acquire);
+
+    if (seq % 2 != 0)
+      continue;
+
+    TypedLock lock{info.waiting_on.load(std::memory_order_relaxed),
+                   info.waiting_on_type.load(std::memory_order_relaxed)};
+    WaitToken wait_token = info.wait_token.load(std::memory_order_relaxed);
+    bool enqueued = info.enqueued.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (info.seq.load(std::memory_order_relaxed) == seq) {
+      return enqueued && lock ? std::optional{WaiterInfo{lock, wait_token}}
+                              : std::nullopt;
+    }
+  }
+
+  return {};
+}
+
+// Stale entries of the waiter and holder tables are invalidated by bumping
+// the generation, instead of clearing them.
+void DeadlockDetector::next_generation() {
+  if (++m_generation == 0) {
+    for (auto &waiter : m_waiters)
+      waiter.generation = 0;
+
+    m_holders.clear();
+    m_generation = 1;
+  }
+}
+
+void DeadlockDetector::add_waiter(thread_id_t tid, WaiterInfo info) {
+  if (tid >= m_waiters.size())
+    m_waiters.resize(tid + 1);
+
+  auto vertex = static_cast<vertex_t>(m_vertex_tids.size());
+
+  m_waiters[tid] = {m_generation, vertex, info};
+  m_vertex_tids.push_back(tid);
+}
+
+void DeadlockDetector::HolderTable::reset(std::size_t max_locks,
+                                          std::uint32_t generation) {
+  std::size_t capacity = MIN_CAPACITY;
+
+  // Keep load factor <= 0.5
+  while (capacity < 2 * max_locks)
+    capacity *= 2;
+
+  if (capacity > m_slots.size())
+    m_slots.assign(capacity, Slot{});
+
+  m_generation = generation;
+}
+
+std::size_t DeadlockDetector::HolderTable::probe(const void *lock) const {
+  std::size_t mask = m_slots.size() - 1;
+  std::size_t i =
+      folly::hash::twang_mix64(reinterpret_cast<std::uintptr_t>(lock)) & mask;
+
+  while (m_slots[i].generation == m_generation && m_slots[i].lock != lock)
+    i = (i + 1) & mask;
+
+  return i;
+}
+
+// Waiters are laid out as vertices `0..n-1` (while gathering), with the
+// edges of each vertex (waiter -> holders of the lock it's waiting on) stored
+// contiguously. Holders which are not waiting themselves can't be part of a
+// cycle, so those edges are dropped.
+void DeadlockDetector::build_wait_for_graph() {
+  m_edge_offsets.clear();
+  m_edges.clear();
+
+  for (thread_id_t tid : m_vertex_tids) {
+    auto holders = m_holders.find(find_waiter(tid)->info.lock.lock());
+
+    m_edge_offsets.push_back(m_edges.size());
+
+    for (std::uint32_t i = 0; i < holders->count; i++) {
+      if (auto *holder = find_waiter(m_holder_tids[holders->first + i]))
+        m_edges.push_back(holder->vertex);
+    }
+  }
+
+  m_edge_offsets.push_back(m_edges.size());
+}
+
+// Iterative Tarjan's SCC, collects every lockcycle into
+// `m_cycle_members`, delimited by `m_cycle_offsets`.
+void DeadlockDetector::detect_lock_cycles() {
+  auto num_vertices = static_cast<vertex_t>(m_vertex_tids.size());
+  vertex_t next_index = 0;
+
+  m_index.assign(num_vertices, NO_VERTEX);
+  m_lowlink.assign(num_vertices, 0);
+  m_scc_stack.clear();
+  m_call_stack.clear();
+  m_cycle_members.clear();
+  m_cycle_offsets.assign(1, 0);
+
+  auto visit = [&](vertex_t v) {
+    m_index[v] = m_lowlink[v] = next_index++;
+    m_scc_stack.push_back(v);
+    m_on_stack[v] = true;
+    m_call_stack.push_back({v, m_edge_offsets[v]});
+  };
+
+  for (vertex_t root = 0; root < num_vertices; root++) {
+    if (m_index[root] != NO_VERTEX)
+      continue;
+
+    visit(root);
+
+    while (!m_call_stack.empty()) {
+      TarjanFrame &frame = m_call_stack.back();
+      vertex_t v = frame.v;
+
+      if (frame.next_edge < m_edge_offsets[v + 1]) {
+        vertex_t w = m_edges[frame.next_edge++];
+
+        if (m_index[w] == NO_VERTEX)
+          visit(w);
+        else if (m_on_stack[w])
+          m_lowlink[v] = std::min(m_lowlink[v], m_index[w]);
+
+        continue;
+      }
+
+      m_call_stack.pop_back();
+
+      if (!m_call_stack.empty()) {
+        vertex_t parent = m_call_stack.back().v;
+        m_lowlink[parent] = std::min(m_lowlink[parent], m_lowlink[v]);
+      }
+
+      if (m_lowlink[v] == m_index[v])
+        pop_component(v);
+    }
+  }
+}
+
+void DeadlockDetector::pop_component(vertex_t root) {
+  auto first = m_cycle_members.size();
+  bool self_loop = false;
+  vertex_t w;
+
+  do {
+    w = m_scc_stack.back();
+    m_scc_stack.pop_back();
+    m_on_stack[w] = false;
+    m_cycle_members.push_back(m_vertex_tids[w]);
+  } while (w != root);
+
+  if (m_cycle_members.size() - first == 1) {
+    for (auto e = m_edge_offsets[root]; e < m_edge_offsets[root + 1]; e++)
+      self_loop |= m_edges[e] == root;
+
+    if (!self_loop) {
+      m_cycle_members.resize(first);
+      return;
+    }
+  }
+
+  m_cycle_offsets.push_back(m_cycle_members.size());
+}
+
+std::optional<ThreadRegistry::thread_id_t>
+DeadlockDetector::select_waiter(const thread_id_t *begin,
+                                const thread_id_t *end) {
+  m_victim_candidates.clear();
+
+  for (const thread_id_t *waiter = begin; waiter != end; waiter++) {
+    const auto &wait_info = get_wait_info(*waiter);
+    const WaiterInfo &snapshot = find_waiter(*waiter)->info;
+    auto record = read_wait_record(wait_info);
+
+    // Verify if still waiting for the same `instance` of lock.
+    if (!record || snapshot.lock != record->lock ||
+        snapshot.wait_token != record->wait_token)
+      return {};
+
+    m_victim_candidates.push_back(
+        {*waiter, snapshot.lock.lock(), snapshot.lock.type()->name,
+         snapshot.wait_token,
+         wait_info.wait_start_time.load(),
+         wait_info.num_held_locks.load(std::memory_order_relaxed),
+         wait_info.priority.load(std::memory_order_relaxed),
+         wait_info.cost.load(std::memory_order_relaxed)});
+  }
+
+  auto victim = m_victim_policy.load()(m_victim_candidates.data(),
+                                       m_victim_candidates.size());
+
+  assert(victim < m_victim_candidates.size());
+
+  SYNC_PRIM_TRACE(trace::DEADLOCK_VICTIM, m_victim_candidates[victim].tid,
+                  m_victim_candidates.size());
+
+  return m_victim_candidates[victim].tid;
+}
+
+bool DeadlockDetector::verify_lock_cycle(const thread_id_t *begin,
+                                         const thread_id_t *end) {
+  auto waiter = select_waiter(begin, end);
+
+  if (!waiter)
+    return false;
+
+  // Members' state is only stable, until the victim is unparked.
+  const WaiterInfo &waiter_info = find_waiter(*waiter)->info;
+  build_report(begin, end, *waiter);
+
+  if (!waiter_info.lock.type()->unpark_waiter(
+          waiter_info.lock.lock(), *waiter, waiter_info.wait_token))
+    return false;
+
+  m_reports.publish(m_report);
+
+  if (auto sink = m_report_sink.load())
+    sink(m_report);
+
+  return true;
+}
+
+// Fills `m_report` from the `m_victim_candidates` of the lockcycle.
+void DeadlockDetector::build_report(const thread_id_t *begin,
+                                    const thread_id_t *end,
+                                    thread_id_t victim) {
+  auto now = Clock::now();
+  auto num_waiters = std::min(m_victim_candidates.size(),
+                              DeadlockReport::MAX_WAITERS);
+
+  m_report.detected_at = now;
+  m_report.victim = victim;
+  m_report.num_waiters = static_cast<std::uint32_t>(m_victim_candidates.size());
+
+  std::lock_guard<std::mutex> lock{m_lock_names_mutex};
+
+  for (std::size_t i = 0; i < num_waiters; i++) {
+    const DeadlockCycleMember &member = m_victim_candidates[i];
+    const ThreadWaitInfo &wait_info = get_wait_info(member.tid);
+    DeadlockReport::Waiter &waiter = m_report.waiters[i];
+    auto holders = m_holders.find(member.lock);
+    auto lock_name = m_lock_names.find(member.lock);
+
+    waiter.tid = member.tid;
+    waiter.holder = ThreadRegistry::INVALID_THREADID;
+    waiter.lock = member.lock;
+    waiter.lock_name =
+        lock_name != m_lock_names.end() ? lock_name->second : nullptr;
+    waiter.lock_type = member.lock_type;
+    waiter.wait_duration = now - member.wait_start_time;
+    waiter.num_held_locks = member.num_held_locks;
+
+    for (std::uint32_t h = 0; h < holders->count; h++) {
+      thread_id_t holder = m_holder_tids[holders->first + h];
+
+      if (std::find(begin, end, holder) != end) {
+        waiter.holder = holder;
+        break;
+      }
+    }
+
+    auto num_tracked =
+        wait_info.num_tracked_locks.load(std::memory_order_relaxed);
+
+    for (std::size_t h = 0; h < waiter.held_locks.size(); h++) {
+      waiter.held_locks[h] =
+          h < num_tracked
+              ? wait_info.held_locks[h].load(std::memory_order_relaxed)
+              : nullptr;
+    }
+  }
+}
+
+void DeadlockDetector::set_lock_name(const void *lock, const char *name) {
+  std::lock_guard<std::mutex> guard{m_lock_names_mutex};
+
+  if (name)
+    m_lock_names[lock] = name;
+  else
+    m_lock_names.erase(lock);
+}
+} // namespace detail
+
+namespace victim_policy {
+// Returns the first member, which is the least as per `less`.
+template <typename Less>
+static std::size_t select_min(const DeadlockCycleMember *members,
+                              std::size_t num_members, Less &&less) {
+  std::size_t victim = 0;
+
+  for (std::size_t i = 1; i < num_members; i++) {
+    if (less(members[i], members[victim]))
+      victim = i;
+  }
+
+  return victim;
+}
+
+std::size_t youngest(const DeadlockCycleMember *members,
+                     std::size_t num_members) {
+  return select_min(members, num_members, [](const auto &a, const auto &b) {
+    return a.wait_start_time > b.wait_start_time;
+  });
+}
+
+std::size_t fewest_held_locks(const DeadlockCycleMember *members,
+                              std::size_t num_members) {
+  return select_min(members, num_members, [](const auto &a, const auto &b) {
+    return a.num_held_locks < b.num_held_locks;
+  });
+}
+
+std::size_t lowest_priority(const DeadlockCycleMember *members,
+                            std::size_t num_members) {
+  return select_min(members, num_members, [](const auto &a, const auto &b) {
+    return a.priority < b.priority;
+  });
+}
+
+std::size_t lowest_cost(const DeadlockCycleMember *members,
+                        std::size_t num_members) {
+  return select_min(members, num_members, [](const auto &a, const auto &b) {
+    return a.cost < b.cost;
+  });
+}
+} // namespace victim_policy
+
+static detail::DeadlockDetectionService deadlock_detection_service{
+    {[](auto since) {
+       return detail::DeadlockDetector::Instance.parked_waiters(since);
+     },
+     []() { return detail::DeadlockDetector::Instance.run(); }}};
+
+int detect_deadlocks() { return detail::DeadlockDetector::Instance.run(); }
+
+void set_deadlock_victim_policy(VictimPolicy policy) {
+  detail::DeadlockDetector::Instance.set_victim_policy(policy);
+}
+
+void set_deadlock_priority(int priority) {
+  detail::DeadlockDetector::Instance.set_priority(priority);
+}
+
+void set_deadlock_cost(std::uint64_t cost) {
+  detail::DeadlockDetector::Instance.set_cost(cost);
+}
+
+void set_deadlock_lock_name(const void *lock, const char *name) {
+  detail::DeadlockDetector::Instance.set_lock_name(lock, name);
+}
+
+void set_deadlock_report_sink(DeadlockReportSink sink) {
+  detail::DeadlockDetector::Instance.set_report_sink(sink);
+}
+
+std::uint64_t scrape_deadlock_reports(std::uint64_t after_id,
+                                      std::vector<DeadlockReport> &reports) {
+  return detail::DeadlockDetector::Instance.scrape_reports(after_id, reports);
+}
+
+bool start_deadlock_detection(DeadlockDetectionOptions options) {
+  detail::DeadlockDetector::Instance.set_service(&deadlock_detection_service);
+  return deadlock_detection_service.start(options);
+}
+
+void stop_deadlock_detection() { deadlock_detection_service.stop(); }
+} // namespace sync_prim
@@ -0,0 +1,66 @@
+#include "sync_prim/mutex/DeadlockReport.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace sync_prim {
+namespace detail {
+void DeadlockReportRing::publish(DeadlockReport &report) {
+  std::array<std::uint64_t, NUM_WORDS> words{};
+
+  report.id = m_last_id.load(std::memory_order_relaxed) + 1;
+  std::memcpy(words.data(), &report, sizeof(report));
+
+  Slot &slot = m_slots[report.id % SIZE];
+  auto seq = slot.seq.load(std::memory_order_relaxed);
+
+  slot.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  for (std::size_t i = 0; i < NUM_WORDS; i++)
+    slot.words[i].store(words[i], std::memory_order_relaxed);
+
+  slot.seq.store(seq + 2, std::memory_order_release);
+  m_last_id.store(report.id, std::memory_order_release);
+}
+
+std::uint64_t
+DeadlockReportRing::scrape(std::uint64_t after_id,
+                           std::vector<DeadlockReport> &reports) const {
+  auto last_id = m_last_id.load(std::memory_order_acquire);
+  auto first_id = last_id >= SIZE ? last_id - SIZE + 1 : 1;
+
+  for (auto id = std::max(after_id + 1, first_id); id <= last_id; id++) {
+    DeadlockReport report;
+
+    // Overwritten by a newer report, which will be scraped the next time.
+    if (!read(m_slots[id % SIZE], report) || report.id != id)
+      continue;
+
+    reports.push_back(report);
+    after_id = id;
+  }
+
+  return after_id;
+}
+
+bool DeadlockReportRing::read(const Slot &slot, DeadlockReport &report) const {
+  std::array<std::uint64_t, NUM_WORDS> words;
+  auto seq = slot.seq.load(std::memory_order_acquire);
+
+  if (seq % 2 != 0)
+    return false;
+
+  for (std::size_t i = 0; i < NUM_WORDS; i++)
+    words[i] = slot.words[i].load(std::memory_order_relaxed);
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  if (slot.seq.load(std::memory_order_relaxed) != seq)
+    return false;
+
+  std::memcpy(static_cast<void *>(&report), words.data(), sizeof(report));
+  return true;
+}
+} // namespace detail
+} // namespace sync_prim
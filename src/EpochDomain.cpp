@@ -0,0 +1,114 @@
+#include "sync_prim/reclamation/EpochDomain.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace sync_prim {
+namespace reclamation {
+void EpochDomain::enter() {
+  ThreadRecord &record = m_records.local();
+
+  if (record.depth++ == 0) {
+    record.announcement.store((m_epoch.load() << 1) | 1);
+
+    // Announcement must be visible, before the shared structure is read.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+}
+
+void EpochDomain::exit() {
+  ThreadRecord &record = m_records.local();
+
+  assert(record.depth != 0);
+
+  if (--record.depth == 0) {
+    record.announcement.store(0);
+
+    // This reader may be the one holding back the epoch.
+    if (m_num_synchronizers.load() != 0) {
+      parkinglot.unpark(
+          this, [](folly::Unit) { return UnparkControl::RemoveContinue; });
+    }
+  }
+}
+
+void EpochDomain::retire(void *ptr, Deleter deleter) {
+  ThreadRecord &record = m_records.local();
+
+  record.retired.push_back({ptr, deleter, m_epoch.load()});
+
+  if (record.retired.size() % RECLAIM_BATCH_SIZE == 0) {
+    try_advance();
+    reclaim(record);
+  }
+}
+
+void EpochDomain::synchronize() {
+  ThreadRecord &record = m_records.local();
+  auto target = m_epoch.load() + 2;
+
+  assert(record.depth == 0);
+
+  while (m_epoch.load() < target) {
+    if (try_advance())
+      continue;
+
+    m_num_synchronizers++;
+
+    // Readers check for synchronizers after leaving their region, so either
+    // the epoch is no longer held back, or the reader will unpark us.
+    parkinglot.park(
+        this, folly::Unit{},
+        [&]() {
+          auto epoch = m_epoch.load();
+          return epoch < target && is_epoch_held_back(epoch);
+        },
+        []() {});
+
+    m_num_synchronizers--;
+  }
+
+  reclaim(record);
+}
+
+bool EpochDomain::try_advance() {
+  auto epoch = m_epoch.load();
+
+  if (is_epoch_held_back(epoch))
+    return false;
+
+  // Somebody else advancing it, is just as good.
+  m_epoch.compare_exchange_strong(epoch, epoch + 1);
+  return true;
+}
+
+bool EpochDomain::is_epoch_held_back(std::uint64_t epoch) {
+  bool held_back = false;
+
+  m_records.for_each([&](ThreadRegistry::thread_id_t, ThreadRecord &record) {
+    auto announcement = record.announcement.load();
+
+    if (announcement != 0 && (announcement >> 1) != epoch)
+      held_back = true;
+  });
+
+  return held_back;
+}
+
+void EpochDomain::reclaim(ThreadRecord &record) {
+  auto epoch = m_epoch.load();
+  auto is_safe = [epoch](const Retired &retired) {
+    return retired.epoch + 2 <= epoch;
+  };
+
+  for (const auto &retired : record.retired) {
+    if (is_safe(retired))
+      retired.deleter(retired.ptr);
+  }
+
+  record.retired.erase(std::remove_if(record.retired.begin(),
+                                      record.retired.end(), is_safe),
+                       record.retired.end());
+}
+} // namespace reclamation
+} // namespace sync_prim
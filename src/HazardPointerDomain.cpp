@@ -0,0 +1,55 @@
+#include "sync_prim/reclamation/HazardPointerDomain.h"
+
+#include <algorithm>
+
+namespace sync_prim {
+namespace reclamation {
+void HazardPointerDomain::retire(void *ptr, Deleter deleter) {
+  ThreadRecord &record = m_records.local();
+
+  record.retired.push_back({ptr, deleter});
+
+  // Scan only once there are more retired objects than hazards, so that
+  // atleast half of them are freed by every scan.
+  auto max_hazards =
+      (ThreadRegistry::MaxThreadID() + std::size_t{1}) * HAZARDS_PER_THREAD;
+
+  if (record.retired.size() >= std::max(RECLAIM_BATCH_SIZE, 2 * max_hazards))
+    reclaim(record);
+}
+
+void HazardPointerDomain::reclaim() { reclaim(m_records.local()); }
+
+void HazardPointerDomain::reclaim(ThreadRecord &record) {
+  auto &protected_ptrs = record.protected_ptrs;
+
+  // Objects were unlinked before being retired, so any hazard published
+  // after this fence can't be protecting them.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  protected_ptrs.clear();
+  m_records.for_each([&](ThreadRegistry::thread_id_t, ThreadRecord &other) {
+    for (const auto &hazard : other.hazards) {
+      if (auto ptr = hazard.load(std::memory_order_acquire))
+        protected_ptrs.push_back(ptr);
+    }
+  });
+
+  std::sort(protected_ptrs.begin(), protected_ptrs.end());
+
+  auto is_protected = [&](const Retired &retired) {
+    return std::binary_search(protected_ptrs.begin(), protected_ptrs.end(),
+                              retired.ptr);
+  };
+
+  // Free the unprotected objects, and keep the rest.
+  auto keep = std::partition(record.retired.begin(), record.retired.end(),
+                             is_protected);
+
+  for (auto it = keep; it != record.retired.end(); ++it)
+    it->deleter(it->ptr);
+
+  record.retired.erase(keep, record.retired.end());
+}
+} // namespace reclamation
+} // namespace sync_prim
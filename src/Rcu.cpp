@@ -0,0 +1,131 @@
+#include "sync_prim/reclamation/Rcu.h"
+
+#include <cassert>
+
+namespace sync_prim {
+namespace reclamation {
+RcuDomain RcuDomain::Instance;
+
+RcuDomain::~RcuDomain() {
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+
+    m_stop = true;
+  }
+
+  m_cond.notify_all();
+
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+void RcuDomain::read_lock() {
+  ReaderRecord &record = m_readers.local();
+
+  if (record.depth++ == 0) {
+    record.snapshot.store(m_grace_period.load(), std::memory_order_relaxed);
+
+    // Snapshot must be visible, before the protected data is read.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+}
+
+void RcuDomain::read_unlock() {
+  ReaderRecord &record = m_readers.local();
+
+  assert(record.depth != 0);
+
+  if (--record.depth == 0) {
+    record.snapshot.store(0);
+
+    // This reader may be the one, a synchronizer is waiting for.
+    if (m_num_synchronizers.load() != 0) {
+      parkinglot.unpark(
+          this, [](folly::Unit) { return UnparkControl::RemoveContinue; });
+    }
+  }
+}
+
+void RcuDomain::synchronize() {
+  assert(m_readers.local().depth == 0);
+
+  // Readers which enter after this, see the new grace period.
+  auto grace_period = m_grace_period.fetch_add(1) + 1;
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  while (has_readers_before(grace_period)) {
+    m_num_synchronizers++;
+
+    // Readers check for synchronizers after leaving their region, so either
+    // they are gone, or they will unpark us.
+    parkinglot.park(
+        this, folly::Unit{},
+        [&]() { return has_readers_before(grace_period); }, []() {});
+
+    m_num_synchronizers--;
+  }
+}
+
+bool RcuDomain::has_readers_before(std::uint64_t grace_period) {
+  bool found = false;
+
+  m_readers.for_each([&](ThreadRegistry::thread_id_t, ReaderRecord &record) {
+    auto snapshot = record.snapshot.load();
+
+    if (snapshot != 0 && snapshot < grace_period)
+      found = true;
+  });
+
+  return found;
+}
+
+void RcuDomain::call(Callback callback, void *arg) {
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+
+    if (!m_thread.joinable())
+      m_thread = std::thread{[this]() { worker(); }};
+
+    m_callbacks.push_back({callback, arg});
+    m_num_queued++;
+  }
+
+  m_cond.notify_all();
+}
+
+void RcuDomain::barrier() {
+  std::unique_lock<std::mutex> lock{m_mutex};
+  auto num_queued = m_num_queued;
+
+  m_cond.wait(lock, [&]() { return m_num_completed >= num_queued; });
+}
+
+void RcuDomain::worker() {
+  std::vector<PendingCallback> batch;
+  std::unique_lock<std::mutex> lock{m_mutex};
+
+  while (true) {
+    m_cond.wait(lock, [&]() { return m_stop || !m_callbacks.empty(); });
+
+    // Pending callbacks are still run, when stopping.
+    if (m_callbacks.empty())
+      break;
+
+    batch.swap(m_callbacks);
+    lock.unlock();
+
+    synchronize();
+
+    for (const auto &pending : batch)
+      pending.callback(pending.arg);
+
+    lock.lock();
+    m_num_completed += batch.size();
+    batch.clear();
+
+    m_cond.notify_all();
+  }
+}
+} // namespace reclamation
+} // namespace sync_prim
@@ -1,75 +1,395 @@
 #include "sync_prim/ThreadRegistry.h"
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
-#include <mutex>
-#include <set>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 namespace sync_prim {
-// Max used tid
-static std::atomic<ThreadRegistry::thread_id_t> max_used_tid =
-    ThreadRegistry::INVALID_THREADID;
+using thread_id_t = ThreadRegistry::thread_id_t;
+
+// Tids are allocated from a two level bitmap: a bit per tid, plus a summary
+// bit per word of tids, which is set when that word is full. Allocation
+// finds the first non full word through the summary, and claims its first
+// zero bit with a CAS. So the lowest free tid is (almost always) handed out,
+// without ever taking a lock.
+static constexpr std::uint32_t BITS_PER_WORD = 64;
+static constexpr std::uint32_t NUM_TID_WORDS =
+    ThreadRegistry::MAX_THREADS / BITS_PER_WORD;
+static constexpr std::uint32_t NUM_SUMMARY_WORDS =
+    (NUM_TID_WORDS + BITS_PER_WORD - 1) / BITS_PER_WORD;
+static constexpr std::uint64_t FULL_WORD = ~std::uint64_t{0};
+
+// Used tids
+static std::array<std::atomic<std::uint64_t>, NUM_TID_WORDS> used_tids{};
+
+// Words of `used_tids`, which are (or were recently) full. It's only a hint:
+// a word may be marked as not full, while it's full, but not vice versa (for
+// long).
+static std::array<std::atomic<std::uint64_t>, NUM_SUMMARY_WORDS> full_words{};
+
+// See ThreadRegistry::Generation
+static std::array<std::atomic<std::uint32_t>, ThreadRegistry::MAX_THREADS>
+    generations{};
+
+// Max used tid + 1, 0 if there are no registered threads.
+// This is an upper bound, while threads are being registered concurrently.
+static std::atomic<std::uint32_t> max_used_tid_end = 0;
 
 // # Registered threads at any moment
 static std::atomic<std::uint32_t> num_registerd_threads = 0;
 
-// ID of calling thread,
-static thread_local ThreadRegistry::thread_id_t tid =
-    ThreadRegistry::INVALID_THREADID;
+// Tid + 1 recently freed on each CPU, 0 if none.
+// See ThreadRegistry::SetTidRecycling
+static std::atomic<bool> tid_recycling = false;
+static std::array<std::atomic<std::uint32_t>,
+                  ThreadRegistry::MAX_TID_CACHE_CPUS>
+    recently_freed_tids{};
 
-// Sorted Freelist and used list of tids
-static std::set<ThreadRegistry::thread_id_t> free_tids = []() {
-  std::set<ThreadRegistry::thread_id_t> free_tids;
+// CPU and node, last seen by each tid. See ThreadRegistry::CurrentCPU
+static std::array<std::atomic<std::uint32_t>, ThreadRegistry::MAX_THREADS>
+    thread_cpus{};
+static std::array<std::atomic<std::uint32_t>, ThreadRegistry::MAX_THREADS>
+    thread_nodes{};
 
-  for (ThreadRegistry::thread_id_t i = 0; i < ThreadRegistry::MAX_THREADS; i++)
-    free_tids.insert(i);
+struct Topology {
+  // NUMA node of each CPU
+  std::vector<std::uint32_t> cpu_nodes;
+  std::uint32_t num_nodes = 1;
+};
 
-  return free_tids;
-}();
-static std::set<ThreadRegistry::thread_id_t> inuse_tids;
-static std::mutex tid_gen_mutex;
+// Set once `auto_unregister` is destroyed. It's trivially destructible, so
+// it's still valid in the TLS destructors run after that.
+static thread_local bool t_exiting = false;
 
-bool ThreadRegistry::RegisterThread() {
-  if (tid != ThreadRegistry::INVALID_THREADID)
+// Releases the tid of a registered thread, when it exits.
+struct AutoUnregister {
+  ~AutoUnregister() {
+    t_exiting = true;
+
+    if (armed)
+      ThreadRegistry::UnregisterThread();
+  }
+
+  bool armed = false;
+};
+
+static thread_local AutoUnregister auto_unregister;
+
+// Threads registering after `auto_unregister` is destroyed (from another TLS
+// destructor, which uses a lock), are unregistered by the destructor of this
+// key instead, as pthread key destructors run after all the TLS destructors.
+static void unregister_at_exit(void *) { ThreadRegistry::UnregisterThread(); }
+
+static pthread_key_t exit_key() {
+  static const pthread_key_t key = []() {
+    pthread_key_t key;
+
+    if (pthread_key_create(&key, unregister_at_exit) != 0) {
+      std::fprintf(stderr, "ThreadRegistry: pthread_key_create failed\n");
+      std::abort();
+    }
+
+    return key;
+  }();
+
+  return key;
+}
+
+static std::uint64_t bit(std::uint32_t index) {
+  return std::uint64_t{1} << (index % BITS_PER_WORD);
+}
+
+static int first_zero_bit(std::uint64_t word) {
+  return __builtin_ctzll(~word);
+}
+
+static void mark_word_full(std::uint32_t word_index) {
+  auto &summary = full_words[word_index / BITS_PER_WORD];
+
+  summary.fetch_or(bit(word_index));
+
+  // A tid of the word may have been freed meanwhile, whose free would have
+  // missed clearing the summary bit.
+  if (used_tids[word_index].load() != FULL_WORD)
+    summary.fetch_and(~bit(word_index));
+}
+
+static thread_id_t allocate_tid_from_word(std::uint32_t word_index) {
+  auto &word = used_tids[word_index];
+  auto used = word.load();
+
+  while (used != FULL_WORD) {
+    auto new_used = used | (std::uint64_t{1} << first_zero_bit(used));
+
+    if (word.compare_exchange_weak(used, new_used)) {
+      if (new_used == FULL_WORD)
+        mark_word_full(word_index);
+
+      return word_index * BITS_PER_WORD + first_zero_bit(used);
+    }
+  }
+
+  return ThreadRegistry::INVALID_THREADID;
+}
+
+// Claim `tid`, if it's still free.
+static bool claim_tid(thread_id_t tid) {
+  auto word_index = tid / BITS_PER_WORD;
+  auto used = used_tids[word_index].fetch_or(bit(tid));
+
+  if (used & bit(tid))
     return false;
 
-  std::lock_guard<std::mutex> lock{tid_gen_mutex};
+  if ((used | bit(tid)) == FULL_WORD)
+    mark_word_full(word_index);
 
-  // Exit if all tids are occupied.
-  if (free_tids.empty())
+  return true;
+}
+
+// Returns the tid recently freed on the calling thread's CPU, if it can be
+// reused without growing MaxThreadID().
+static thread_id_t allocate_recycled_tid() {
+  auto cpu = ThreadRegistry::CurrentCPU();
+
+  if (cpu >= ThreadRegistry::MAX_TID_CACHE_CPUS)
+    return ThreadRegistry::INVALID_THREADID;
+
+  auto cached = recently_freed_tids[cpu].exchange(0);
+
+  if (cached == 0 || cached > max_used_tid_end.load() ||
+      !claim_tid(cached - 1))
+    return ThreadRegistry::INVALID_THREADID;
+
+  return cached - 1;
+}
+
+static thread_id_t allocate_tid() {
+  for (std::uint32_t i = 0; i < NUM_SUMMARY_WORDS; i++) {
+    auto full = full_words[i].load();
+
+    while (full != FULL_WORD) {
+      auto word_index = i * BITS_PER_WORD + first_zero_bit(full);
+
+      if (word_index >= NUM_TID_WORDS)
+        break;
+
+      auto new_tid = allocate_tid_from_word(word_index);
+
+      if (new_tid != ThreadRegistry::INVALID_THREADID)
+        return new_tid;
+
+      // Filled up by others, try the next one.
+      full |= bit(word_index);
+    }
+  }
+
+  return ThreadRegistry::INVALID_THREADID;
+}
+
+static void free_tid(thread_id_t old_tid) {
+  auto word_index = old_tid / BITS_PER_WORD;
+
+  used_tids[word_index].fetch_and(~bit(old_tid));
+  full_words[word_index / BITS_PER_WORD].fetch_and(~bit(word_index));
+}
+
+// Returns max used tid + 1, or 0 if none is used.
+static std::uint32_t find_max_used_tid_end() {
+  for (auto i = NUM_TID_WORDS; i > 0; i--) {
+    if (auto used = used_tids[i - 1].load())
+      return (i - 1) * BITS_PER_WORD + BITS_PER_WORD - __builtin_clzll(used);
+  }
+
+  return 0;
+}
+
+// Reads a cpu list file (for eg: "0-3,8-11"), calling `func` for every entry
+// in it. Returns false, if the file couldn't be read.
+template <typename Func>
+static bool read_cpu_list(const char *path, Func func) {
+  std::ifstream file{path};
+  std::string list;
+
+  if (!std::getline(file, list))
     return false;
 
-  tid = *std::begin(free_tids);
+  const char *pos = list.c_str();
+
+  while (*pos != '\0') {
+    char *end;
+    auto first = std::strtoul(pos, &end, 10);
 
-  free_tids.erase(std::begin(free_tids));
-  inuse_tids.insert(tid);
+    if (end == pos)
+      return false;
 
-  max_used_tid = *std::rbegin(inuse_tids);
+    auto last = first;
 
+    if (*end == '-') {
+      pos = end + 1;
+      last = std::strtoul(pos, &end, 10);
+
+      if (end == pos)
+        return false;
+    }
+
+    for (auto i = first; i <= last; i++)
+      func(static_cast<std::uint32_t>(i));
+
+    if (*end != ',')
+      break;
+
+    pos = end + 1;
+  }
+
+  return true;
+}
+
+static Topology build_topology() {
+  Topology topology;
+  std::uint32_t num_cpus = 0;
+  std::uint32_t num_nodes = 0;
+
+  auto count_cpu = [&](std::uint32_t cpu) {
+    num_cpus = std::max(num_cpus, cpu + 1);
+  };
+
+  if (!read_cpu_list("/sys/devices/system/cpu/possible", count_cpu))
+    num_cpus = std::max(sysconf(_SC_NPROCESSORS_CONF), 1L);
+
+  topology.cpu_nodes.assign(num_cpus, 0);
+
+  read_cpu_list("/sys/devices/system/node/possible", [&](auto node) {
+    char path[64];
+
+    std::snprintf(path, sizeof(path),
+                  "/sys/devices/system/node/node%u/cpulist", node);
+    read_cpu_list(path, [&](auto cpu) {
+      if (cpu < num_cpus)
+        topology.cpu_nodes[cpu] = node;
+    });
+
+    num_nodes = std::max(num_nodes, node + 1);
+  });
+
+  topology.num_nodes = std::max(num_nodes, 1u);
+
+  return topology;
+}
+
+static const Topology &topology() {
+  static const Topology cached = build_topology();
+
+  return cached;
+}
+
+static void raise_max_used_tid_end(std::uint32_t end) {
+  auto max_end = max_used_tid_end.load();
+
+  while (max_end < end &&
+         !max_used_tid_end.compare_exchange_weak(max_end, end)) {
+  }
+}
+
+// Must be called after `old_tid` is freed.
+static void lower_max_used_tid_end(thread_id_t old_tid) {
+  std::uint32_t max_end = old_tid + 1;
+
+  // Only the thread freeing the max tid lowers the max. Threads concurrently
+  // freeing lower tids may have been seen as still in use by its scan, while
+  // they saw it as the max, and left the lowering to it. So it rescans,
+  // until the max is stable.
+  while (max_used_tid_end.load() == max_end) {
+    auto new_end = find_max_used_tid_end();
+
+    if (new_end >= max_end ||
+        !max_used_tid_end.compare_exchange_strong(max_end, new_end))
+      return;
+
+    // A thread registered during the scan may have seen the old max, and
+    // left it as is. Its tid is visible now, so account for it.
+    raise_max_used_tid_end(find_max_used_tid_end());
+    max_end = new_end;
+  }
+}
+
+bool ThreadRegistry::RegisterThread() {
+  if (t_tid != ThreadRegistry::INVALID_THREADID)
+    return false;
+
+  auto new_tid = ThreadRegistry::INVALID_THREADID;
+
+  if (tid_recycling.load(std::memory_order_relaxed))
+    new_tid = allocate_recycled_tid();
+
+  if (new_tid == ThreadRegistry::INVALID_THREADID)
+    new_tid = allocate_tid();
+
+  // Exit if all tids are occupied.
+  if (new_tid == ThreadRegistry::INVALID_THREADID)
+    return false;
+
+  if (__builtin_expect(t_exiting, 0)) {
+    // Any non null value, for the destructor to be called.
+    pthread_setspecific(exit_key(), &t_exiting);
+  } else {
+    auto_unregister.armed = true;
+  }
+
+  t_generation = ++generations[new_tid];
+  t_tid = new_tid;
+  raise_max_used_tid_end(new_tid + 1);
   num_registerd_threads++;
 
+  // Publish the tid's CPU and node.
+  RefreshCPU();
+
   return true;
 }
 
 void ThreadRegistry::UnregisterThread() {
-  if (tid != ThreadRegistry::INVALID_THREADID) {
-    std::lock_guard<std::mutex> lock{tid_gen_mutex};
+  if (t_tid != ThreadRegistry::INVALID_THREADID) {
+    auto old_tid = t_tid;
+
+    t_tid = ThreadRegistry::INVALID_THREADID;
+    generations[old_tid]++;
+    free_tid(old_tid);
+    lower_max_used_tid_end(old_tid);
 
-    free_tids.insert(tid);
-    inuse_tids.erase(tid);
+    if (tid_recycling.load(std::memory_order_relaxed)) {
+      auto cpu = CurrentCPU();
 
-    tid = ThreadRegistry::INVALID_THREADID;
-    max_used_tid = inuse_tids.size() ? *std::rbegin(inuse_tids)
-                                     : ThreadRegistry::INVALID_THREADID;
+      if (cpu < MAX_TID_CACHE_CPUS)
+        recently_freed_tids[cpu].store(old_tid + 1);
+    }
 
     num_registerd_threads--;
   }
 }
 
-ThreadRegistry::thread_id_t ThreadRegistry::ThreadID() {
-  assert(tid != ThreadRegistry::INVALID_THREADID);
+ThreadRegistry::thread_id_t ThreadRegistry::RegisterThreadSlow() {
+  // Carrying on with an INVALID_THREADID would corrupt the locks.
+  if (!RegisterThread()) {
+    std::fprintf(stderr, "ThreadRegistry: all %u thread ids are in use\n",
+                 static_cast<unsigned>(MAX_THREADS));
+    std::abort();
+  }
 
-  return tid;
+  return t_tid;
+}
+
+std::uint32_t ThreadRegistry::Generation(thread_id_t tid) {
+  assert(tid < ThreadRegistry::MAX_THREADS);
+
+  return generations[tid].load(std::memory_order_acquire);
 }
 
 std::uint32_t ThreadRegistry::NumRegisteredThreads() {
@@ -77,7 +397,75 @@ std::uint32_t ThreadRegistry::NumRegisteredThreads() {
 }
 
 ThreadRegistry::thread_id_t ThreadRegistry::MaxThreadID() {
-  return max_used_tid;
+  // 0 - 1 wraps around to INVALID_THREADID, when no thread is registered.
+  return max_used_tid_end.load() - 1;
+}
+
+std::uint64_t ThreadRegistry::UsedTids(std::uint32_t word) {
+  assert(word < NUM_TID_WORDS);
+
+  return used_tids[word].load(std::memory_order_acquire);
+}
+
+void ThreadRegistry::SetTidRecycling(bool enable) {
+  tid_recycling = enable;
+
+  if (!enable) {
+    for (auto &tid : recently_freed_tids)
+      tid = 0;
+  }
+}
+
+std::uint32_t ThreadRegistry::NumCPUs() {
+  return topology().cpu_nodes.size();
+}
+
+std::uint32_t ThreadRegistry::NumNodes() { return topology().num_nodes; }
+
+std::uint32_t ThreadRegistry::NodeOfCPU(std::uint32_t cpu) {
+  const auto &cpu_nodes = topology().cpu_nodes;
+
+  return cpu < cpu_nodes.size() ? cpu_nodes[cpu] : 0;
+}
+
+std::uint32_t ThreadRegistry::RefreshCPU() {
+  // glibc's sched_getcpu reads the cpu id from the thread's rseq area, when
+  // it's registered with rseq, and falls back to the getcpu vDSO otherwise.
+  // So neither takes a syscall.
+  auto cpu = sched_getcpu();
+
+  t_cpu = cpu < 0 ? 0 : cpu;
+  t_node = NodeOfCPU(t_cpu);
+  t_cpu_countdown = CPU_REFRESH_INTERVAL - 1;
+
+  if (t_tid != INVALID_THREADID) {
+    thread_cpus[t_tid].store(t_cpu, std::memory_order_relaxed);
+    thread_nodes[t_tid].store(t_node, std::memory_order_relaxed);
+  }
+
+  return t_cpu;
+}
+
+std::uint32_t ThreadRegistry::CPU(thread_id_t tid) {
+  assert(tid < ThreadRegistry::MAX_THREADS);
+
+  return thread_cpus[tid].load(std::memory_order_relaxed);
+}
+
+std::uint32_t ThreadRegistry::Node(thread_id_t tid) {
+  assert(tid < ThreadRegistry::MAX_THREADS);
+
+  return thread_nodes[tid].load(std::memory_order_relaxed);
+}
+
+void ThreadRegistry::ThreadsOnNode(std::uint32_t node,
+                                   std::vector<thread_id_t> &tids) {
+  tids.clear();
+
+  ForEachThread([&](thread_id_t tid) {
+    if (Node(tid) == node)
+      tids.push_back(tid);
+  });
 }
 
 } // namespace sync_prim
@@ -9,97 +9,370 @@
 ------------------------------------------------------------------------*/
 
 #include "sync_prim/TraceLog.h"
+#include "sync_prim/Trace.h"
 
 #include <algorithm>
-#include <memory>
+#include <chrono>
+#include <cinttypes>
+#include <cstddef>
+#include <map>
+#include <new>
+#include <set>
 #include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <utility>
 
-namespace sync_prim {
-TraceLog TraceLog::Instance;
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-TraceLog::TraceLog() : m_head(new Page), m_tail(m_head), m_numPages(1) {}
+namespace sync_prim {
+folly::Indestructible<TraceLog> TraceLog::Instance;
 
 TraceLog::~TraceLog() {
-  // Pages are not cleaned up
+  if (auto *file = m_file.load(std::memory_order_acquire))
+    munmap(file, m_fileSize);
 }
 
-TraceLog::Event *TraceLog::allocateEventFromNewPage() {
-  std::lock_guard<std::mutex> lock(m_mutex);
-
-  // Double-checked locking:
-  // Check again whether the current page is full. Another thread may have
-  // called allocateEventFromNewPage and created a new page by the time we get
-  // take the lock.
-  Page *oldTail = m_tail.load(std::memory_order_relaxed);
-
-  if (static_cast<unsigned>(oldTail->index.load(std::memory_order_relaxed)) <
-      EventsPerPage) {
-    int index = oldTail->index.fetch_add(1, std::memory_order_relaxed);
-    // Yes! We got a slot on this page.
-    if (static_cast<unsigned>(index) < EventsPerPage)
-      return &oldTail->events[index];
-  }
+void TraceLog::allocateBuffer(ThreadBuffer &buffer) {
+  auto *file = m_file.load(std::memory_order_acquire);
+  auto tid = ThreadRegistry::ThreadID();
 
-  // OK, we're definitely out of space. It's up to us to allocate a new page.
-  Page *newTail = new Page;
-  // Reserve the first slot.
-  newTail->index.store(1, std::memory_order_relaxed);
-  // A plain non-atomic move to oldTail->next is fine because there are no other
-  // writers here, and nobody is supposed to read the logged contents until all
-  // logging is complete.
-  oldTail->next = newTail;
-  // m_tail must be written atomically because it is read concurrently from
-  // other threads. We also use release/consume semantics so that its
-  // constructed contents are visible to other threads. Again, very much like
-  // the double-checked locking pattern.
-  m_tail.store(newTail, std::memory_order_release);
-
-  if (m_numPages >= MaxNumPages) {
-    Page *oldHead = m_head;
-    m_head = oldHead->next;
-    delete oldHead;
+  if (file && tid < file->numRings) {
+    auto *ring = reinterpret_cast<char *>(file) + file->ringsOffset +
+                 tid * file->ringSize;
+
+    buffer.count = &reinterpret_cast<trace_file::RingHeader *>(ring)->count;
+    buffer.mask = file->eventsPerRing - 1;
+    buffer.events = reinterpret_cast<Event *>(ring + file->eventsOffset);
   } else {
-    m_numPages++;
+    buffer.heapEvents.reset(new Event[EventsPerThread]);
+    buffer.mask = EventsPerThread - 1;
+    buffer.events = buffer.heapEvents.get();
+  }
+}
+
+void TraceLog::insertFormat(trace_file::Format *formats,
+                            std::uint32_t numFormats, std::uint32_t slot,
+                            const char *fmt) {
+  auto key = reinterpret_cast<std::uintptr_t>(fmt);
+
+  // Starts at a free slot, but others may be taking it (and the following
+  // ones) meanwhile, possibly for `fmt` itself.
+  for (std::uint32_t i = 0; i < numFormats; i++) {
+    auto &format = formats[(slot + i) & (numFormats - 1)];
+    std::uint64_t expected = 0;
+
+    if (format.fmt.compare_exchange_strong(expected, key,
+                                           std::memory_order_acq_rel)) {
+      strncpy(format.text, fmt, trace_file::MAX_FORMAT_LENGTH);
+      format.ready.store(1, std::memory_order_release);
+      return;
+    }
+
+    // Copied by another thread (or being copied).
+    if (expected == key)
+      return;
   }
+}
+
+bool TraceLog::mapFile(const char *path, std::uint32_t numRings,
+                       std::uint64_t eventsPerRing) {
+  using namespace trace_file;
+
+  if (m_file.load(std::memory_order_acquire) || numRings == 0 ||
+      eventsPerRing == 0)
+    return false;
+
+  auto align = [](std::uint64_t size, std::uint64_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+  };
+
+  std::uint64_t capacity = 1;
+
+  while (capacity < eventsPerRing)
+    capacity *= 2;
+
+  std::uint64_t formatsOffset = align(sizeof(Header), alignof(Format));
+  std::uint64_t ringsOffset =
+      align(formatsOffset + NUM_FORMATS * sizeof(Format), alignof(RingHeader));
+  std::uint64_t eventsOffset = align(sizeof(RingHeader), alignof(Event));
+  std::uint64_t ringSize =
+      align(eventsOffset + capacity * sizeof(Event), alignof(RingHeader));
+  std::uint64_t size = ringsOffset + numRings * ringSize;
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0)
+    return false;
+
+  // Blocks are allocated, and pages mapped up front, so that logging neither
+  // page faults, nor gets a SIGBUS on a full disk.
+  void *addr = posix_fallocate(fd, 0, size) == 0
+                   ? mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, 0)
+                   : MAP_FAILED;
+
+  close(fd);
+
+  if (addr == MAP_FAILED)
+    return false;
+
+  auto *file = new (addr) Header{};
+  auto *base = static_cast<char *>(addr);
+
+  for (std::uint32_t i = 0; i < NUM_FORMATS; i++)
+    new (base + formatsOffset + i * sizeof(Format)) Format{};
+
+  for (std::uint32_t i = 0; i < numRings; i++)
+    new (base + ringsOffset + i * ringSize) RingHeader{};
+
+  file->version = VERSION;
+  file->headerSize = sizeof(Header);
+  file->formatsOffset = formatsOffset;
+  file->formatSize = sizeof(Format);
+  file->numFormats = NUM_FORMATS;
+  file->ringsOffset = ringsOffset;
+  file->ringSize = ringSize;
+  file->eventsOffset = eventsOffset;
+  file->numRings = numRings;
+  file->eventSize = sizeof(Event);
+  file->eventsPerRing = capacity;
+  file->pointerSize = sizeof(void *);
+  file->tidOffset = offsetof(Event, tid);
+  file->fmtOffset = offsetof(Event, fmt);
+  file->param1Offset = offsetof(Event, param1);
+  file->param2Offset = offsetof(Event, param2);
+  file->tscOffset = offsetof(Event, tsc);
+  file->ticksPerNanosecond = ticksPerNanosecond();
+  // Last, so that a file is recognized only once it's complete.
+  memcpy(file->magic, MAGIC, sizeof(MAGIC));
+
+  m_fileSize = size;
+  m_file.store(file, std::memory_order_release);
+
+  return true;
+}
+
+double TraceLog::ticksPerNanosecond() {
+  static const double ticksPerNs = [] {
+#if defined(__x86_64__) || defined(__i386__)
+    using Clock = std::chrono::steady_clock;
+
+    auto startTime = Clock::now();
+    auto startTsc = readTsc();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    auto endTsc = readTsc();
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - startTime;
+
+    return (endTsc - startTsc) / elapsed.count();
+#else
+    return 1.0;
+#endif
+  }();
+
+  return ticksPerNs;
+}
+
+TraceLog::Iterator::Iterator(std::vector<Cursor> cursors)
+    : m_heap(std::move(cursors)) {
+  std::make_heap(m_heap.begin(), m_heap.end(), later);
+}
+
+TraceLog::Iterator &TraceLog::Iterator::operator++() {
+  std::pop_heap(m_heap.begin(), m_heap.end(), later);
 
-  // Return the reserved slot.
-  return &newTail->events[0];
+  Cursor &cursor = m_heap.back();
+
+  // Put the thread back, with its next event.
+  if (++cursor.pos < cursor.end)
+    std::push_heap(m_heap.begin(), m_heap.end(), later);
+  else
+    m_heap.pop_back();
+
+  return *this;
+}
+
+TraceLog::Iterator TraceLog::begin() {
+  std::vector<Iterator::Cursor> cursors;
+
+  m_buffers.for_each_owned_ever(
+      [&](ThreadRegistry::thread_id_t, ThreadBuffer &buffer) {
+        auto count = buffer.count->load(std::memory_order_acquire);
+        auto capacity = buffer.mask + 1;
+
+        // Older events have been overwritten.
+        if (count != 0) {
+          cursors.push_back({buffer.events, buffer.mask,
+                             count > capacity ? count - capacity : 0, count});
+        }
+      });
+
+  return Iterator(std::move(cursors));
 }
 
 void TraceLog::dumpStats() {
-  unsigned numEvents = 0;
-  {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    numEvents = (m_numPages - 1) * EventsPerPage +
-                m_tail.load(std::memory_order_consume)
-                    ->index.load(std::memory_order_relaxed);
-  }
-  printf("%u events logged\n", numEvents);
+  std::uint64_t numEvents = 0;
+  std::uint64_t numRetained = 0;
+
+  m_buffers.for_each_owned_ever(
+      [&](ThreadRegistry::thread_id_t, ThreadBuffer &buffer) {
+        auto count = buffer.count->load(std::memory_order_acquire);
+
+        numEvents += count;
+        numRetained += std::min<std::uint64_t>(count, buffer.mask + 1);
+      });
+
+  printf("%" PRIu64 " events logged, %" PRIu64 " retained\n", numEvents,
+         numRetained);
 }
 
-void TraceLog::dumpEntireLog(const char *path, unsigned startPage) {
-  std::lock_guard<std::mutex> lock(m_mutex);
+bool TraceLog::dumpEntireLog(const char *path) {
   FILE *f = path ? fopen(path, "w") : stderr;
 
-  for (Page *page = m_head; page; page = page->next) {
-    if (startPage > 0) {
-      startPage--;
-      continue;
+  if (!f)
+    return false;
+
+  std::uint64_t startTsc = 0;
+  bool first = true;
+
+  for (const Event &evt : *this) {
+    if (first) {
+      startTsc = evt.tsc;
+      first = false;
     }
 
-    unsigned limit = std::min(
-        EventsPerPage,
-        static_cast<unsigned>(page->index.load(std::memory_order_relaxed)));
+    fprintf(f, "%14.3f us ", toNanoseconds(evt.tsc - startTsc) / 1000);
+    fprintf(f, evt.fmt, evt.tid, evt.param1, evt.param2);
+    fputc('\n', f);
+  }
+
+  return f == stderr || fclose(f) == 0;
+}
+
+// Writes `str` as a JSON string.
+static void writeJsonString(FILE *f, const char *str) {
+  fputc('"', f);
+
+  for (; *str; str++) {
+    auto c = static_cast<unsigned char>(*str);
+
+    if (c == '"' || c == '\\')
+      fprintf(f, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(f, "\\u%04x", c);
+    else
+      fputc(c, f);
+  }
+
+  fputc('"', f);
+}
+
+bool TraceLog::dumpChromeTrace(const char *path) {
+  FILE *f = fopen(path, "w");
+
+  if (!f)
+    return false;
+
+  // Start of the open hold slices, by (tid, lock), and of the open wait
+  // slices, by tid (a thread waits for one thing at a time).
+  std::map<std::pair<int, uintptr_t>, std::uint64_t> holds;
+  std::map<int, std::pair<uintptr_t, std::uint64_t>> waits;
+  std::set<int> tids;
+  std::uint64_t startTsc = 0;
+  std::uint64_t lastTsc = 0;
+  const char *separator = "\n";
+
+  auto micros = [&](std::uint64_t tsc) {
+    return toNanoseconds(tsc - startTsc) / 1000;
+  };
+
+  auto writeSlice = [&](int tid, const char *name, uintptr_t lock,
+                        std::uint64_t begin, std::uint64_t end) {
+    fprintf(f,
+            "%s{\"ph\":\"X\",\"cat\":\"lock\",\"pid\":1,\"tid\":%d,"
+            "\"name\":\"%s 0x%" PRIxPTR "\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"args\":{\"lock\":\"0x%" PRIxPTR "\"}}",
+            separator, tid, name, lock, micros(begin),
+            micros(end) - micros(begin), lock);
+    separator = ",\n";
+  };
+
+  auto writeInstant = [&](const Event &evt) {
+    char message[256];
+
+    snprintf(message, sizeof(message), evt.fmt, evt.tid, evt.param1,
+             evt.param2);
+
+    // The tid is shown by the track.
+    const char *name = strstr(message, "] ");
+    name = name ? name + 2 : message;
 
-    for (unsigned i = 0; i < limit; i++) {
-      const Event &evt = page->events[i];
+    fprintf(f, "%s{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"name\":",
+            separator, evt.tid);
+    writeJsonString(f, name);
+    fprintf(f, ",\"ts\":%.3f}", micros(evt.tsc));
+    separator = ",\n";
+  };
 
-      fprintf(f, evt.fmt, evt.tid, evt.param1, evt.param2);
-      fputc('\n', f);
+  fputs("{\"traceEvents\":[", f);
+
+  for (const Event &evt : *this) {
+    if (tids.empty())
+      startTsc = evt.tsc;
+
+    tids.insert(evt.tid);
+    lastTsc = evt.tsc;
+
+    if (evt.fmt == trace::LOCK_ACQUIRED) {
+      holds[{evt.tid, evt.param1}] = evt.tsc;
+    } else if (evt.fmt == trace::LOCK_RELEASED) {
+      auto hold = holds.find({evt.tid, evt.param1});
+
+      // Acquired before the oldest retained event.
+      if (hold != holds.end()) {
+        writeSlice(evt.tid, "hold", evt.param1, hold->second, evt.tsc);
+        holds.erase(hold);
+      }
+    } else if (evt.fmt == trace::PARK) {
+      waits[evt.tid] = {evt.param1, evt.tsc};
+    } else if (evt.fmt == trace::UNPARKED || evt.fmt == trace::PARK_TIMEOUT) {
+      auto wait = waits.find(evt.tid);
+
+      if (wait != waits.end()) {
+        writeSlice(evt.tid,
+                   evt.fmt == trace::UNPARKED ? "wait" : "wait (timed out)",
+                   wait->second.first, wait->second.second, evt.tsc);
+        waits.erase(wait);
+      }
+    } else {
+      writeInstant(evt);
     }
   }
 
-  fclose(f);
+  // Slices still open at the end of the log, are cut off there.
+  for (const auto &hold : holds)
+    writeSlice(hold.first.first, "hold", hold.first.second, hold.second,
+               lastTsc);
+
+  for (const auto &wait : waits)
+    writeSlice(wait.first, "wait", wait.second.first, wait.second.second,
+               lastTsc);
+
+  for (int tid : tids) {
+    fprintf(f,
+            "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\","
+            "\"args\":{\"name\":\"tid %d\"}}",
+            separator, tid, tid);
+    separator = ",\n";
+  }
+
+  fputs("\n],\"displayTimeUnit\":\"ns\"}\n", f);
+
+  return fclose(f) == 0;
 }
 
-} // namespace sync_prim
\ No newline at end of file
+} // namespace sync_prim
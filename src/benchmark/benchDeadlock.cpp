@@ -0,0 +1,382 @@
+#include "sync_prim/ShardedCounter.h"
+#include "sync_prim/ThreadRegistry.h"
+#include "sync_prim/barrier.h"
+#include "sync_prim/mutex/Mutex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+using sync_prim::mutex::DeadlockSafeMutex;
+using sync_prim::mutex::MutexLockResult;
+using Clock = std::chrono::steady_clock;
+
+// Shape of the wait-for graph built by every iteration.
+//   ring     - a single lockcycle of all the threads
+//   disjoint - independent lockcycles of `cyclesize` threads each
+//   chain    - wait chains of `cyclesize` threads, which never deadlock, but
+//              must still be traversed by every detection pass
+enum class Shape { RING, DISJOINT, CHAIN };
+
+struct BMArgs {
+  Shape shape;
+  std::string shape_name;
+  int num_threads;
+  int cycle_size;
+  int iterations;
+  int passes;
+  bool service;
+  int timeout;
+  int traffic_threads;
+  int traffic_locks;
+  int traffic_time;
+
+  friend std::ostream &operator<<(std::ostream &out, const BMArgs &args) {
+    out << "Shape = " << args.shape_name << ", Threads = " << args.num_threads
+        << ", Cycle Size = " << args.cycle_size
+        << ", Iterations = " << args.iterations
+        << ", Detection = " << (args.service ? "service" : "manual")
+        << ", Traffic Threads = " << args.traffic_threads;
+
+    return out;
+  }
+};
+
+struct BMStats {
+  std::vector<double> pass_us;
+  std::vector<double> resolution_us;
+  int num_deadlocks = 0;
+};
+
+static BMArgs parse_args(int argc, const char *argv[]);
+static void report_latency(const std::string &str, std::vector<double> vec);
+
+// Unrelated lock traffic, which keeps running while waiters are parked and
+// the detector is busy.
+class LockTraffic {
+public:
+  LockTraffic(int num_threads, int num_locks) : m_locks(num_locks) {
+    for (int i = 0; i < num_threads; i++)
+      m_workers.emplace_back([this, i]() { worker(i); });
+  }
+
+  ~LockTraffic() {
+    m_quit = true;
+
+    for (auto &worker : m_workers)
+      worker.join();
+  }
+
+  std::uint64_t ops() { return m_ops.load(); }
+
+private:
+  void worker(int i) {
+    sync_prim::ThreadRegistry::RegisterThread();
+
+    auto next = static_cast<std::size_t>(i);
+
+    while (!m_quit) {
+      auto &m = m_locks[next++ % m_locks.size()];
+
+      if (m.lock() == MutexLockResult::LOCKED)
+        m.unlock();
+
+      m_ops.add();
+    }
+
+    sync_prim::ThreadRegistry::UnregisterThread();
+  }
+
+  std::vector<DeadlockSafeMutex> m_locks;
+  std::vector<std::thread> m_workers;
+  std::atomic<bool> m_quit = false;
+  sync_prim::ShardedCounter m_ops;
+};
+
+static double ops_per_sec(LockTraffic &traffic,
+                          std::chrono::milliseconds duration) {
+  auto start_ops = traffic.ops();
+  auto start = Clock::now();
+
+  std::this_thread::sleep_for(duration);
+
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  return (traffic.ops() - start_ops) / elapsed.count();
+}
+
+// Detection passes run by `timed_service`. Only written by its thread, and
+// read once it's stopped.
+static std::vector<double> service_pass_us;
+
+// Same as the service started by sync_prim::start_deadlock_detection, but
+// with every detection pass timed.
+static sync_prim::detail::DeadlockDetectionService timed_service{
+    {[](auto since) {
+       return sync_prim::detail::DeadlockDetector::Instance.parked_waiters(
+           since);
+     },
+     []() {
+       auto start = Clock::now();
+       int num_deadlocks = sync_prim::detail::DeadlockDetector::Instance.run();
+       std::chrono::duration<double, std::micro> latency = Clock::now() - start;
+
+       service_pass_us.push_back(latency.count());
+       return num_deadlocks;
+     }}};
+
+// Build the wait-for graph of `args.shape` once and wait for it to be resolved
+// (deadlocks broken by the detector, chains released by us).
+static void run_iteration(const BMArgs &args, BMStats &stats) {
+  int group_size =
+      args.shape == Shape::RING ? args.num_threads : args.cycle_size;
+  int num_groups = args.num_threads / group_size;
+  int num_threads = num_groups * group_size;
+  bool cyclic = args.shape != Shape::CHAIN;
+  std::size_t num_waiters = cyclic ? num_threads : num_threads - num_groups;
+
+  std::vector<DeadlockSafeMutex> locks(num_threads);
+  std::vector<std::thread> workers;
+  std::vector<double> resolution_us(num_threads, 0);
+  std::atomic<bool> release_chains = false;
+  std::atomic<int> num_deadlocks = 0;
+  sync_prim::barrier lock_phase{num_threads};
+
+  auto worker = [&](int group, int member) {
+    sync_prim::ThreadRegistry::RegisterThread();
+
+    int self = group * group_size + member;
+    int next = group * group_size + (member + 1) % group_size;
+    bool waits = cyclic || member + 1 < group_size;
+
+    locks[self].lock();
+    lock_phase.arrive_and_wait();
+
+    if (waits) {
+      auto start = Clock::now();
+      auto ret = locks[next].lock();
+
+      if (ret == MutexLockResult::LOCKED) {
+        locks[next].unlock();
+      } else {
+        std::chrono::duration<double, std::micro> latency =
+            Clock::now() - start;
+
+        resolution_us[self] = latency.count();
+        num_deadlocks++;
+      }
+    } else {
+      while (!release_chains)
+        std::this_thread::yield();
+    }
+
+    locks[self].unlock();
+    sync_prim::ThreadRegistry::UnregisterThread();
+  };
+
+  for (int group = 0; group < num_groups; group++) {
+    for (int member = 0; member < group_size; member++)
+      workers.emplace_back(worker, group, member);
+  }
+
+  if (!args.service || !cyclic) {
+    // Only count the waiters of the graph, not those of the lock traffic.
+    auto is_graph_lock = [&](const void *lock) {
+      std::less<const void *> less;
+
+      return !less(lock, locks.data()) &&
+             less(lock, locks.data() + locks.size());
+    };
+
+    while (sync_prim::detail::DeadlockDetector::Instance.num_parked_on(
+               is_graph_lock) < num_waiters)
+      std::this_thread::yield();
+
+    // Every waiter is enqueued by now, so the first pass should break all the
+    // deadlocks, but don't rely on it.
+    int num_broken = 0;
+
+    for (int pass = 0; cyclic ? num_broken < num_groups : pass < args.passes;
+         pass++) {
+      auto start = Clock::now();
+
+      num_broken += sync_prim::detect_deadlocks();
+
+      std::chrono::duration<double, std::micro> latency = Clock::now() - start;
+      stats.pass_us.push_back(latency.count());
+    }
+
+    release_chains = true;
+  }
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  stats.num_deadlocks += num_deadlocks;
+
+  for (double latency : resolution_us) {
+    if (latency != 0)
+      stats.resolution_us.push_back(latency);
+  }
+}
+
+static void do_bench(const BMArgs &args) {
+  std::cout << "Benchmark -> " << args << std::endl;
+
+  BMStats stats;
+  std::chrono::milliseconds traffic_time{args.traffic_time};
+  LockTraffic traffic{args.traffic_threads, args.traffic_locks};
+  double idle_ops =
+      args.traffic_threads ? ops_per_sec(traffic, traffic_time) : 0;
+  auto start_ops = traffic.ops();
+  auto start = Clock::now();
+
+  if (args.service) {
+    sync_prim::DeadlockDetectionOptions options;
+
+    options.timeout = std::chrono::milliseconds{args.timeout};
+    sync_prim::detail::DeadlockDetector::Instance.set_service(&timed_service);
+    timed_service.start(options);
+  }
+
+  for (int i = 0; i < args.iterations; i++)
+    run_iteration(args, stats);
+
+  if (args.service) {
+    timed_service.stop();
+    stats.pass_us.insert(stats.pass_us.end(), service_pass_us.begin(),
+                         service_pass_us.end());
+  }
+
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  double busy_ops = (traffic.ops() - start_ops) / elapsed.count();
+
+  std::cout << std::setw(25) << "Deadlocks Broken = " << stats.num_deadlocks
+            << "\n";
+  report_latency("Detection Pass = ", stats.pass_us);
+  report_latency("Time To Resolution = ", stats.resolution_us);
+
+  if (args.traffic_threads) {
+    std::cout << std::setw(25) << "Traffic (idle) = " << std::fixed
+              << std::setprecision(0) << idle_ops << " ops/s\n";
+    std::cout << std::setw(25) << "Traffic (detecting) = " << busy_ops
+              << " ops/s (" << std::setprecision(2)
+              << (100 * (busy_ops / idle_ops - 1)) << "%)\n";
+  }
+}
+
+int main(int argc, const char *argv[]) { do_bench(parse_args(argc, argv)); }
+
+static void report_latency(const std::string &str, std::vector<double> vec) {
+  if (vec.empty()) {
+    std::cout << std::setw(25) << str << "N/A\n";
+    return;
+  }
+
+  std::sort(vec.begin(), vec.end());
+
+  auto mean = std::accumulate(vec.begin(), vec.end(), 0.0) / vec.size();
+  auto percentile = [&](double p) {
+    return vec[std::min(vec.size() - 1, static_cast<std::size_t>(
+                                            p * (vec.size() - 1) + 0.5))];
+  };
+
+  std::cout << std::setw(25) << str << std::fixed << std::setprecision(2)
+            << "mean " << mean << " us, p50 " << percentile(0.5)
+            << " us, p99 " << percentile(0.99) << " us, max " << vec.back()
+            << " us\n";
+}
+
+static BMArgs parse_args(int argc, const char *argv[]) {
+  using namespace boost::program_options;
+
+  options_description desc{"Benchmark Options"};
+  desc.add_options()("help,h", "Help screen")(
+      "shape", value<std::string>()->default_value("disjoint")->required(),
+      "Wait-for graph: ring / disjoint / chain")(
+      "numthreads", value<int>()->default_value(1000)->required(),
+      "# Threads waiting")("cyclesize",
+                           value<int>()->default_value(4)->required(),
+                           "# Threads in each cycle / chain")(
+      "iterations", value<int>()->default_value(10)->required(),
+      "# Times the graph is built")(
+      "passes", value<int>()->default_value(100)->required(),
+      "# Detection passes per iteration (chain only)")(
+      "service", value<bool>()->default_value(false)->required(),
+      "Break deadlocks using the detection service, instead of manual "
+      "passes")("timeout", value<int>()->default_value(10)->required(),
+                "Detection service timeout (ms)")(
+      "trafficthreads", value<int>()->default_value(0)->required(),
+      "# Threads generating unrelated lock traffic")(
+      "trafficlocks", value<int>()->default_value(64)->required(),
+      "# Locks used by the unrelated lock traffic")(
+      "traffictime", value<int>()->default_value(1000)->required(),
+      "Duration of the idle traffic measurement (ms)");
+
+  variables_map vm;
+  store(parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << '\n';
+    std::exit(0);
+  } else {
+    try {
+      BMArgs args;
+
+      notify(vm);
+
+      args.shape_name = vm["shape"].as<std::string>();
+      args.num_threads = vm["numthreads"].as<int>();
+      args.cycle_size = vm["cyclesize"].as<int>();
+      args.iterations = vm["iterations"].as<int>();
+      args.passes = vm["passes"].as<int>();
+      args.service = vm["service"].as<bool>();
+      args.timeout = vm["timeout"].as<int>();
+      args.traffic_threads = vm["trafficthreads"].as<int>();
+      args.traffic_locks = vm["trafficlocks"].as<int>();
+      args.traffic_time = vm["traffictime"].as<int>();
+
+      if (args.shape_name == "ring")
+        args.shape = Shape::RING;
+      else if (args.shape_name == "disjoint")
+        args.shape = Shape::DISJOINT;
+      else if (args.shape_name == "chain")
+        args.shape = Shape::CHAIN;
+      else
+        throw std::string{"ERROR: Unknown shape " + args.shape_name};
+
+      if (args.cycle_size < 2 || args.num_threads < args.cycle_size)
+        throw std::string{"ERROR: Need 2 <= cyclesize <= numthreads"};
+
+      if (args.traffic_locks < 1)
+        throw std::string{"ERROR: Need atleast one traffic lock"};
+
+      return args;
+    } catch (const std::string &ex) {
+      std::cerr << ex << '\n';
+      std::cout << desc << '\n';
+      std::exit(-1);
+    } catch (error &e) {
+      std::cerr << e.what() << '\n';
+      std::cout << desc << '\n';
+      std::exit(-1);
+    } catch (const std::exception &ex) {
+      std::cerr << ex.what() << '\n';
+      std::cout << desc << '\n';
+      std::exit(-1);
+    }
+  }
+}
@@ -0,0 +1,317 @@
+// Decodes a TraceLog file (see TraceLog::mapFile), left behind by a process
+// that crashed or hung. Events of all the rings are merged by timestamp, and
+// printed like TraceLog::dumpEntireLog.
+//
+// The file is only read, so it can be decoded while the process is still
+// logging (for eg: to look at a hang): events overwritten while being read
+// are dropped.
+
+#include "sync_prim/TraceFile.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+using sync_prim::trace_file::Format;
+using sync_prim::trace_file::Header;
+using sync_prim::trace_file::RingHeader;
+
+struct Event {
+  std::uint64_t tsc;
+  int tid;
+  std::uint64_t fmt;
+  std::uint64_t param1;
+  std::uint64_t param2;
+};
+
+class TraceFile {
+public:
+  TraceFile(const char *data, std::size_t size)
+      : m_data(data), m_size(size),
+        m_header(reinterpret_cast<const Header *>(data)) {}
+
+  // Returns an error message, if the file isn't a (complete) trace file, that
+  // this decoder understands.
+  const char *validate() const;
+
+  // Formats, by their address in the process that logged them.
+  std::unordered_map<std::uint64_t, std::string> formats() const;
+
+  // Appends the retained events of the ring, in the order they were logged.
+  // Returns the # events ever logged to it.
+  std::uint64_t readRing(std::uint32_t ring, std::vector<Event> &events) const;
+
+  const Header &header() const { return *m_header; }
+
+private:
+  const char *m_data;
+  std::size_t m_size;
+  const Header *m_header;
+
+  // Whether [offset, offset + size) is in the file.
+  bool inFile(std::uint64_t offset, std::uint64_t size) const {
+    return offset <= m_size && size <= m_size - offset;
+  }
+
+  std::uint64_t readField(const char *event, std::uint32_t offset,
+                          std::uint32_t size) const {
+    std::uint64_t value = 0;
+
+    // Little endian
+    memcpy(&value, event + offset, size);
+    return value;
+  }
+};
+
+const char *TraceFile::validate() const {
+  const Header &header = *m_header;
+
+  if (m_size < sizeof(Header) ||
+      memcmp(header.magic, sync_prim::trace_file::MAGIC,
+             sizeof(header.magic)) != 0)
+    return "not a trace file, or an incomplete one";
+
+  if (header.version != sync_prim::trace_file::VERSION ||
+      header.headerSize != sizeof(Header) ||
+      header.formatSize != sizeof(Format))
+    return "unsupported version";
+
+  if (header.numFormats == 0 ||
+      (header.numFormats & (header.numFormats - 1)) != 0 ||
+      header.formatsOffset % alignof(Format) != 0 ||
+      !inFile(header.formatsOffset,
+              std::uint64_t(header.numFormats) * header.formatSize))
+    return "corrupt format table";
+
+  if (header.eventSize == 0 || header.pointerSize > sizeof(std::uint64_t) ||
+      header.tidOffset + sizeof(int) > header.eventSize ||
+      header.fmtOffset + header.pointerSize > header.eventSize ||
+      header.param1Offset + header.pointerSize > header.eventSize ||
+      header.param2Offset + header.pointerSize > header.eventSize ||
+      header.tscOffset + sizeof(std::uint64_t) > header.eventSize)
+    return "corrupt event layout";
+
+  if (header.eventsPerRing == 0 ||
+      (header.eventsPerRing & (header.eventsPerRing - 1)) != 0 ||
+      header.eventsOffset < sizeof(RingHeader) ||
+      header.ringSize % alignof(RingHeader) != 0 ||
+      header.ringsOffset % alignof(RingHeader) != 0 ||
+      header.eventsPerRing > header.ringSize / header.eventSize ||
+      header.eventsOffset + header.eventsPerRing * header.eventSize >
+          header.ringSize ||
+      header.ringsOffset > m_size ||
+      header.numRings > (m_size - header.ringsOffset) / header.ringSize)
+    return "corrupt rings";
+
+  if (!(header.ticksPerNanosecond > 0))
+    return "corrupt timestamp frequency";
+
+  return nullptr;
+}
+
+std::unordered_map<std::uint64_t, std::string> TraceFile::formats() const {
+  std::unordered_map<std::uint64_t, std::string> formats;
+  auto *table =
+      reinterpret_cast<const Format *>(m_data + m_header->formatsOffset);
+
+  for (std::uint32_t i = 0; i < m_header->numFormats; i++) {
+    const Format &format = table[i];
+
+    if (format.ready.load(std::memory_order_acquire)) {
+      formats[format.fmt.load(std::memory_order_relaxed)] =
+          std::string(format.text, strnlen(format.text, sizeof(format.text)));
+    }
+  }
+
+  return formats;
+}
+
+std::uint64_t TraceFile::readRing(std::uint32_t ring,
+                                  std::vector<Event> &events) const {
+  const Header &header = *m_header;
+  auto *base = m_data + header.ringsOffset + ring * header.ringSize;
+  auto &count = reinterpret_cast<const RingHeader *>(base)->count;
+  auto capacity = header.eventsPerRing;
+  auto end = count.load(std::memory_order_acquire);
+  auto begin = end > capacity ? end - capacity : 0;
+  auto first = events.size();
+
+  for (auto pos = begin; pos < end; pos++) {
+    auto *event = base + header.eventsOffset +
+                  (pos & (capacity - 1)) * header.eventSize;
+
+    events.push_back(
+        {readField(event, header.tscOffset, sizeof(std::uint64_t)),
+         static_cast<int>(readField(event, header.tidOffset, sizeof(int))),
+         readField(event, header.fmtOffset, header.pointerSize),
+         readField(event, header.param1Offset, header.pointerSize),
+         readField(event, header.param2Offset, header.pointerSize)});
+  }
+
+  // Events logged meanwhile, have overwritten the oldest ones. The event at
+  // the count may also be half written (by a crashed or running process),
+  // over the oldest event of a full ring.
+  auto overwritten = count.load(std::memory_order_acquire) + 1;
+
+  if (overwritten > begin + capacity) {
+    auto num_lost = std::min(overwritten - capacity - begin, end - begin);
+
+    events.erase(events.begin() + first, events.begin() + first + num_lost);
+  }
+
+  return end;
+}
+
+// Whether `fmt` is safe to print with (int tid, uintptr_t, uintptr_t): it's
+// from the file, so only integer conversions are allowed, and at most 3.
+static bool is_safe_format(const std::string &fmt) {
+  int num_conversions = 0;
+
+  for (std::size_t i = 0; i < fmt.size(); i++) {
+    if (fmt[i] != '%')
+      continue;
+
+    if (++i < fmt.size() && fmt[i] == '%')
+      continue;
+
+    i = fmt.find_first_not_of("-+ #0123456789.hljzt", i);
+
+    if (i == std::string::npos || !strchr("diouxXc", fmt[i]))
+      return false;
+
+    if (++num_conversions > 3)
+      return false;
+  }
+
+  return true;
+}
+
+static void print_events(const TraceFile &file, std::vector<Event> &events,
+                         std::uint64_t num_last) {
+  auto formats = file.formats();
+
+  std::stable_sort(
+      events.begin(), events.end(),
+      [](const Event &a, const Event &b) { return a.tsc < b.tsc; });
+
+  auto first = events.size() > num_last ? events.size() - num_last : 0;
+
+  for (auto i = first; i < events.size(); i++) {
+    const Event &evt = events[i];
+    double micros = (evt.tsc - events[first].tsc) /
+                    file.header().ticksPerNanosecond / 1000;
+    auto fmt = formats.find(evt.fmt);
+
+    printf("%14.3f us ", micros);
+
+    if (fmt != formats.end() && is_safe_format(fmt->second)) {
+      printf(fmt->second.c_str(), evt.tid, uintptr_t(evt.param1),
+             uintptr_t(evt.param2));
+    } else {
+      printf("[%d] format 0x%" PRIx64 " (0x%" PRIx64 ", 0x%" PRIx64 ")",
+             evt.tid, evt.fmt, evt.param1, evt.param2);
+    }
+
+    putchar('\n');
+  }
+}
+
+static int decode(const std::string &path, std::uint64_t num_last) {
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path.c_str());
+    return 1;
+  }
+
+  std::size_t size = st.st_size;
+  void *addr = size ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)
+                    : MAP_FAILED;
+
+  close(fd);
+
+  if (addr == MAP_FAILED) {
+    std::cerr << path << ": not a trace file, or an incomplete one"
+              << std::endl;
+    return 1;
+  }
+
+  TraceFile file{static_cast<const char *>(addr), size};
+
+  if (auto *error = file.validate()) {
+    std::cerr << path << ": " << error << std::endl;
+    munmap(addr, size);
+    return 1;
+  }
+
+  std::vector<Event> events;
+  std::uint64_t num_logged = 0;
+
+  for (std::uint32_t ring = 0; ring < file.header().numRings; ring++)
+    num_logged += file.readRing(ring, events);
+
+  std::cerr << events.size() << " events retained, of " << num_logged
+            << " logged" << std::endl;
+
+  print_events(file, events, num_last);
+  munmap(addr, size);
+
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  namespace po = boost::program_options;
+
+  po::options_description options{"TraceLog File Decoder"};
+  po::positional_options_description positional;
+
+  options.add_options()("help,h", "Display this help message");
+
+  options.add_options()("file,f", po::value<std::string>()->required(),
+                        "Trace file, written by TraceLog::mapFile");
+  options.add_options()("last,n", po::value<std::uint64_t>(),
+                        "Print only the last n events");
+  positional.add("file", 1);
+
+  try {
+    po::variables_map vm;
+
+    po::store(po::command_line_parser(argc, argv)
+                  .options(options)
+                  .positional(positional)
+                  .run(),
+              vm);
+
+    if (vm.count("help")) {
+      std::cout << options << std::endl;
+      return 0;
+    }
+
+    po::notify(vm);
+
+    return decode(vm["file"].as<std::string>(),
+                  vm.count("last") ? vm["last"].as<std::uint64_t>()
+                                   : UINT64_MAX);
+  } catch (const po::error &ex) {
+    std::cerr << "ERROR: " << ex.what() << std::endl;
+    std::cerr << options << std::endl;
+  } catch (...) {
+    std::cerr << options << std::endl;
+  }
+
+  return 1;
+}
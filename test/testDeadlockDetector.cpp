@@ -0,0 +1,354 @@
+#include "sync_prim/mutex/FairMutex.h"
+#include "sync_prim/mutex/Mutex.h"
+#include "testMutexUtils.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_SUITE_BEGIN("DeadlockDetector");
+
+using sync_prim::mutex::DeadlockSafeMutex;
+using sync_prim::mutex::FairDeadlockSafeMutex;
+using sync_prim::mutex::MutexLockResult;
+
+// Every pair of threads deadlocks on a DeadlockSafeMutex and a
+// FairDeadlockSafeMutex, which is only visible to a detector that sees both
+// the lock types.
+TEST_CASE("Deadlock Detection Across Lock Types") {
+  constexpr int NumPairs = 20;
+
+  std::vector<DeadlockSafeMutex> mutexes(NumPairs);
+  std::vector<FairDeadlockSafeMutex> fair_mutexes(NumPairs);
+  std::vector<std::thread> workers;
+  std::atomic<int> deadlock_count = 0;
+  std::atomic<int> success_count = 0;
+  sync_prim::barrier lock_phase{2 * NumPairs};
+
+  auto worker = [&](auto &m1, auto &m2) {
+    sync_prim::ThreadRegistry::RegisterThread();
+
+    REQUIRE(m1.lock() == MutexLockResult::LOCKED);
+
+    lock_phase.arrive_and_wait();
+
+    auto ret = m2.lock();
+
+    if (ret == MutexLockResult::LOCKED)
+      m2.unlock();
+
+    m1.unlock();
+
+    if (ret == MutexLockResult::DEADLOCKED)
+      deadlock_count++;
+    else
+      success_count++;
+
+    sync_prim::ThreadRegistry::UnregisterThread();
+  };
+
+  REQUIRE(sync_prim::start_deadlock_detection());
+
+  for (int i = 0; i < NumPairs; i++) {
+    workers.emplace_back([&, i]() { worker(mutexes[i], fair_mutexes[i]); });
+    workers.emplace_back([&, i]() { worker(fair_mutexes[i], mutexes[i]); });
+  }
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  sync_prim::stop_deadlock_detection();
+
+  REQUIRE(deadlock_count == NumPairs);
+  REQUIRE(success_count == NumPairs);
+}
+
+// Returns the member of a 3 thread lockcycle, aborted by `policy`.
+// Thread `i` has priority `i`, cost `Costs[i]` and holds `2 - i` locks other
+// than the one in the cycle.
+static int find_victim(sync_prim::VictimPolicy policy) {
+  constexpr int NumThreads = 3;
+  constexpr std::array<std::uint64_t, NumThreads> Costs = {1, 0, 2};
+
+  std::array<DeadlockSafeMutex, NumThreads> mutexes;
+  std::array<std::array<DeadlockSafeMutex, NumThreads>, NumThreads>
+      extra_mutexes;
+  std::vector<std::thread> workers;
+  std::atomic<int> victim = -1;
+  sync_prim::barrier lock_phase{NumThreads};
+
+  auto worker = [&](int i) {
+    sync_prim::ThreadRegistry::RegisterThread();
+    sync_prim::set_deadlock_priority(i);
+    sync_prim::set_deadlock_cost(Costs[i]);
+
+    for (int j = 0; j < NumThreads - 1 - i; j++)
+      REQUIRE(extra_mutexes[i][j].lock() == MutexLockResult::LOCKED);
+
+    REQUIRE(mutexes[i].lock() == MutexLockResult::LOCKED);
+
+    lock_phase.arrive_and_wait();
+
+    auto &next = mutexes[(i + 1) % NumThreads];
+    auto ret = next.lock();
+
+    if (ret == MutexLockResult::LOCKED)
+      next.unlock();
+    else
+      victim = i;
+
+    mutexes[i].unlock();
+
+    for (int j = 0; j < NumThreads - 1 - i; j++)
+      extra_mutexes[i][j].unlock();
+
+    sync_prim::set_deadlock_priority(0);
+    sync_prim::set_deadlock_cost(0);
+    sync_prim::ThreadRegistry::UnregisterThread();
+  };
+
+  using namespace std::chrono_literals;
+  sync_prim::DeadlockDetectionOptions options;
+
+  options.timeout = 10ms;
+  sync_prim::set_deadlock_victim_policy(policy);
+  REQUIRE(sync_prim::start_deadlock_detection(options));
+
+  for (int i = 0; i < NumThreads; i++)
+    workers.emplace_back(worker, i);
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  sync_prim::stop_deadlock_detection();
+  sync_prim::set_deadlock_victim_policy(sync_prim::victim_policy::youngest);
+
+  return victim;
+}
+
+TEST_CASE("Deadlock Victim Policies") {
+  CHECK(find_victim(sync_prim::victim_policy::lowest_priority) == 0);
+  CHECK(find_victim(sync_prim::victim_policy::lowest_cost) == 1);
+  CHECK(find_victim(sync_prim::victim_policy::fewest_held_locks) == 2);
+}
+
+static std::atomic<int> num_reports_sunk = 0;
+
+TEST_CASE("Deadlock Reports") {
+  constexpr int NumExtraLocks = sync_prim::DeadlockReport::MAX_HELD_LOCKS + 2;
+
+  std::array<DeadlockSafeMutex, 2> mutexes;
+  // Held by the 1st worker, more than can be tracked.
+  std::array<DeadlockSafeMutex, NumExtraLocks> extra_mutexes;
+  std::vector<std::thread> workers;
+  sync_prim::barrier lock_phase{2};
+  std::vector<sync_prim::DeadlockReport> reports;
+  // Skip the reports of the previous tests.
+  auto last_id = sync_prim::scrape_deadlock_reports(0, reports);
+
+  auto worker = [&](int i) {
+    sync_prim::ThreadRegistry::RegisterThread();
+
+    // Release a tracked and an untracked lock, leaving room for mutexes[0].
+    if (i == 0) {
+      for (auto &mutex : extra_mutexes)
+        REQUIRE(mutex.lock() == MutexLockResult::LOCKED);
+
+      extra_mutexes.front().unlock();
+      extra_mutexes.back().unlock();
+    }
+
+    REQUIRE(mutexes[i].lock() == MutexLockResult::LOCKED);
+
+    lock_phase.arrive_and_wait();
+
+    auto &next = mutexes[1 - i];
+    if (next.lock() == MutexLockResult::LOCKED)
+      next.unlock();
+
+    mutexes[i].unlock();
+
+    if (i == 0) {
+      for (int j = 1; j < NumExtraLocks - 1; j++)
+        extra_mutexes[j].unlock();
+    }
+
+    sync_prim::ThreadRegistry::UnregisterThread();
+  };
+
+  sync_prim::set_deadlock_lock_name(&mutexes[0], "first");
+  sync_prim::set_deadlock_lock_name(&mutexes[1], "second");
+  sync_prim::set_deadlock_report_sink(
+      [](const sync_prim::DeadlockReport &) { num_reports_sunk++; });
+
+  for (int i = 0; i < 2; i++)
+    workers.emplace_back(worker, i);
+
+  while (sync_prim::detect_deadlocks() == 0)
+    std::this_thread::yield();
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  sync_prim::set_deadlock_report_sink(nullptr);
+  sync_prim::set_deadlock_lock_name(&mutexes[0], nullptr);
+  sync_prim::set_deadlock_lock_name(&mutexes[1], nullptr);
+
+  reports.clear();
+  REQUIRE(sync_prim::scrape_deadlock_reports(last_id, reports) > last_id);
+  REQUIRE(reports.size() == 1);
+  REQUIRE(num_reports_sunk == 1);
+
+  const auto &report = reports.front();
+  REQUIRE(report.num_waiters == 2);
+
+  for (std::uint32_t i = 0; i < report.num_waiters; i++) {
+    const auto &waiter = report.waiters[i];
+    const auto &other = report.waiters[1 - i];
+    int held = waiter.lock == &mutexes[0] ? 1 : 0;
+
+    CHECK(std::string{waiter.lock_name} == (held ? "first" : "second"));
+    CHECK(std::string{waiter.lock_type} == "DeadlockSafeMutex");
+    CHECK(waiter.holder == other.tid);
+
+    if (held == 1) {
+      CHECK(waiter.num_held_locks == 1);
+      CHECK(waiter.held_locks[0] == &mutexes[held]);
+      CHECK(waiter.held_locks[1] == nullptr);
+    } else {
+      const auto &held_locks = waiter.held_locks;
+
+      CHECK(waiter.num_held_locks == NumExtraLocks - 1);
+      CHECK(std::find(held_locks.begin(), held_locks.end(), &mutexes[0]) !=
+            held_locks.end());
+      CHECK(std::find(held_locks.begin(), held_locks.end(), nullptr) ==
+            held_locks.end());
+    }
+  }
+
+  CHECK((report.victim == report.waiters[0].tid ||
+         report.victim == report.waiters[1].tid));
+}
+
+// A waiter, which has been waiting long (legitimately), and never deadlocks.
+static const auto long_wait_start = std::chrono::steady_clock::now();
+static std::atomic<int> num_passes = 0;
+static std::size_t num_long_waiters = 1;
+
+TEST_CASE("Deadlock Detection Service Backoff") {
+  using namespace std::chrono_literals;
+  using Service = sync_prim::detail::DeadlockDetectionService;
+
+  Service service{{[](Service::TimePoint) {
+                     Service::Waiters waiters;
+
+                     waiters.count = num_long_waiters;
+                     waiters.oldest_wait_start = long_wait_start;
+                     return waiters;
+                   },
+                   []() {
+                     num_passes++;
+                     return 0;
+                   }}};
+  sync_prim::DeadlockDetectionOptions options;
+
+  options.timeout = 0ms;
+  options.min_poll_interval = 1ms;
+  options.max_poll_interval = 64ms;
+
+  REQUIRE(service.start(options));
+  std::this_thread::sleep_for(500ms);
+  service.stop();
+
+  // Passes that find nothing back off to `max_poll_interval`, instead of
+  // running every `min_poll_interval` (~500 passes).
+  CHECK(num_passes >= 5);
+  CHECK(num_passes <= 25);
+
+  // With many waiters parked, the interval starts out scaled up to
+  // `max_poll_interval`, instead of doubling from `min_poll_interval`
+  // (~9 passes in 500ms).
+  num_passes = 0;
+  num_long_waiters = 1000 * options.waiters_per_poll_step;
+  options.max_poll_interval = 1000ms;
+
+  REQUIRE(service.start(options));
+  std::this_thread::sleep_for(500ms);
+  service.stop();
+
+  CHECK(num_passes >= 1);
+  CHECK(num_passes <= 2);
+  num_long_waiters = 1;
+}
+
+// A cycle, which forms while a (slow) pass is running.
+static std::atomic<std::chrono::steady_clock::time_point> cycle_start{};
+static std::atomic<std::chrono::steady_clock::time_point> cycle_broken{};
+
+TEST_CASE("Deadlock Detection Service Catches Cycles Formed During A Pass") {
+  using namespace std::chrono_literals;
+  using Service = sync_prim::detail::DeadlockDetectionService;
+
+  Service service{
+      {[](Service::TimePoint since) {
+         Service::Waiters waiters;
+
+         waiters.count = num_long_waiters;
+         waiters.oldest_wait_start = long_wait_start;
+
+         if (auto start = cycle_start.load(); start != Service::TimePoint{}) {
+           waiters.count += 2;
+
+           if (start > since)
+             waiters.oldest_new_wait_start = start;
+         }
+
+         return waiters;
+       },
+       []() {
+         if (cycle_start.load() == Service::TimePoint{}) {
+           std::this_thread::sleep_for(50ms);
+           cycle_start = Service::Clock::now();
+           std::this_thread::sleep_for(50ms);
+           return 0;
+         }
+
+         if (cycle_broken.load() == Service::TimePoint{})
+           cycle_broken = Service::Clock::now();
+
+         return 1;
+       }}};
+  sync_prim::DeadlockDetectionOptions options;
+
+  // Keep the poll interval at `max_poll_interval`, only a new waiter can
+  // get a pass sooner.
+  num_long_waiters = 1000 * options.waiters_per_poll_step;
+  options.timeout = 50ms;
+  options.min_poll_interval = 1ms;
+  options.max_poll_interval = 5000ms;
+
+  REQUIRE(service.start(options));
+
+  auto deadline = Service::Clock::now() + 2s;
+
+  while (cycle_broken.load() == Service::TimePoint{} &&
+         Service::Clock::now() < deadline)
+    std::this_thread::sleep_for(1ms);
+
+  service.stop();
+  num_long_waiters = 1;
+
+  REQUIRE(cycle_broken.load() != Service::TimePoint{});
+  // Broken about `timeout` after it formed, not `max_poll_interval` after
+  // the pass it formed in.
+  CHECK(cycle_broken.load() - cycle_start.load() < 500ms);
+}
+
+TEST_SUITE_END();
@@ -13,8 +13,10 @@ TEST_CASE("FairMutex Basic") {
   MutexBasicTest<Mutex>([](Mutex &m) { return m.lock(); });
 }
 
-template <bool WaitUntilFree = false> void TestDeadlockDetection() {
-  MutexDeadlockDetectionTest<Mutex>([](Mutex &m) {
+template <bool WaitUntilFree = false, int NumCycles = 1,
+          bool UseService = false>
+void TestDeadlockDetection() {
+  MutexDeadlockDetectionTest<Mutex, 100, NumCycles, UseService>([](Mutex &m) {
     if constexpr (WaitUntilFree)
       return m.lock_or_wait();
     else
@@ -24,6 +26,14 @@ template <bool WaitUntilFree = false> void TestDeadlockDetection() {
 
 TEST_CASE("FairMutex Deadlock Detection") { TestDeadlockDetection(); }
 
+TEST_CASE("FairMutex Multiple Deadlocks Detection") {
+  TestDeadlockDetection<false, 10>();
+}
+
+TEST_CASE("FairMutex Deadlock Detection Service") {
+  TestDeadlockDetection<false, 10, true>();
+}
+
 TEST_CASE("FairMutex AcquireOrWait") {
   MutexBasicTest<Mutex>([](Mutex &m) { return m.lock_or_wait(); });
 }
@@ -13,4 +13,14 @@ TEST_CASE("Mutex Deadlock Detection") {
   MutexDeadlockDetectionTest<Mutex>([](Mutex &m) { return m.lock(); });
 }
 
+TEST_CASE("Mutex Multiple Deadlocks Detection") {
+  MutexDeadlockDetectionTest<Mutex, 100, 10>(
+      [](Mutex &m) { return m.lock(); });
+}
+
+TEST_CASE("Mutex Deadlock Detection Service") {
+  MutexDeadlockDetectionTest<Mutex, 100, 10, true>(
+      [](Mutex &m) { return m.lock(); });
+}
+
 TEST_SUITE_END();
\ No newline at end of file
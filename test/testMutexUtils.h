@@ -44,8 +44,16 @@ void MutexBasicTest(LockFunc &&lockfunc) {
   REQUIRE(counter == Count * NumThreads);
 }
 
-template <typename DeadlockSafeMutex, int NumThreads = 100, typename Lock2Func>
+// Threads are split into `NumCycles` disjoint lock rings, each of which must
+// be broken by exactly one deadlock.
+// Deadlocks are detected either by polling `detect_deadlocks`, or by the
+// mutex's background deadlock detection service.
+template <typename DeadlockSafeMutex, int NumThreads = 100, int NumCycles = 1,
+          bool UseService = false, typename Lock2Func>
 void MutexDeadlockDetectionTest(Lock2Func &&lock2func) {
+  static_assert(NumThreads % NumCycles == 0);
+  constexpr int CycleLength = NumThreads / NumCycles;
+
   std::vector<DeadlockSafeMutex> mutexes(NumThreads);
   std::vector<std::thread> workers;
   std::atomic<int> deadlock_count = 0;
@@ -78,28 +86,45 @@ void MutexDeadlockDetectionTest(Lock2Func &&lock2func) {
   };
 
   std::atomic<bool> quit = false;
-  std::thread deadlock_detection_worker([&quit]() {
-    while (!quit) {
-      using namespace std::chrono_literals;
-      static auto DEADLOCK_DETECT_TIMEOUT = 100ms;
-
-      std::this_thread::sleep_for(DEADLOCK_DETECT_TIMEOUT);
-      DeadlockSafeMutex::detect_deadlocks();
-    }
-  });
+  std::thread deadlock_detection_worker;
+
+  if constexpr (UseService) {
+    using namespace std::chrono_literals;
+    sync_prim::DeadlockDetectionOptions options;
+
+    options.timeout = 10ms;
+    REQUIRE(DeadlockSafeMutex::start_deadlock_detection(options));
+  } else {
+    deadlock_detection_worker = std::thread([&quit]() {
+      while (!quit) {
+        using namespace std::chrono_literals;
+        static auto DEADLOCK_DETECT_TIMEOUT = 100ms;
+
+        std::this_thread::sleep_for(DEADLOCK_DETECT_TIMEOUT);
+        DeadlockSafeMutex::detect_deadlocks();
+      }
+    });
+  }
 
   for (int i = 0; i < NumThreads; i++) {
+    int cycle_start = i - i % CycleLength;
+    int next = cycle_start + (i + 1) % CycleLength;
+
     workers.emplace_back(worker, std::ref(mutexes[i]),
-                         std::ref(mutexes[(i + 1) % NumThreads]));
+                         std::ref(mutexes[next]));
   }
 
   for (auto &worker : workers) {
     worker.join();
   }
 
-  quit = true;
-  deadlock_detection_worker.join();
+  if constexpr (UseService) {
+    DeadlockSafeMutex::stop_deadlock_detection();
+  } else {
+    quit = true;
+    deadlock_detection_worker.join();
+  }
 
-  REQUIRE(deadlock_count == 1);
-  REQUIRE(success_count == NumThreads - 1);
+  REQUIRE(deadlock_count == NumCycles);
+  REQUIRE(success_count == NumThreads - NumCycles);
 }
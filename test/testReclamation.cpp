@@ -0,0 +1,284 @@
+#include "sync_prim/reclamation/EpochDomain.h"
+#include "sync_prim/reclamation/HazardPointerDomain.h"
+#include "sync_prim/reclamation/Rcu.h"
+
+#include "doctest/doctest.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+TEST_SUITE_BEGIN("Reclamation");
+
+using namespace std::chrono_literals;
+
+namespace {
+struct Node {
+  static constexpr std::uint64_t LIVE = 0x5AFE5AFE5AFE5AFE;
+
+  explicit Node(std::uint64_t a_value) : value(a_value) { num_live++; }
+  ~Node() {
+    magic = 0;
+    num_live--;
+  }
+
+  std::uint64_t magic = LIVE;
+  std::uint64_t value;
+
+  static inline std::atomic<int> num_live = 0;
+};
+} // namespace
+
+TEST_CASE("EpochDomain Readers And Writers") {
+  constexpr int NumReaders = 8;
+  constexpr int NumUpdates = 20000;
+
+  {
+    sync_prim::reclamation::EpochDomain domain;
+    std::atomic<Node *> shared{new Node{0}};
+    std::atomic<bool> quit = false;
+    std::atomic<bool> corrupted = false;
+    std::vector<std::thread> readers;
+
+    for (int i = 0; i < NumReaders; i++) {
+      readers.emplace_back([&]() {
+        while (!quit) {
+          sync_prim::reclamation::EpochDomain::Guard guard{domain};
+          Node *node = shared.load();
+
+          if (node->magic != Node::LIVE)
+            corrupted = true;
+        }
+      });
+    }
+
+    std::thread writer{[&]() {
+      for (int i = 1; i <= NumUpdates; i++)
+        domain.retire(shared.exchange(new Node(i)));
+
+      domain.synchronize();
+    }};
+
+    writer.join();
+    quit = true;
+
+    for (auto &reader : readers) {
+      reader.join();
+    }
+
+    REQUIRE(!corrupted);
+    REQUIRE(shared.load()->value == NumUpdates);
+
+    delete shared.load();
+  }
+
+  // Objects not reclaimed yet, are freed along with the domain.
+  REQUIRE(Node::num_live == 0);
+}
+
+TEST_CASE("EpochDomain Synchronize Waits For Readers") {
+  sync_prim::reclamation::EpochDomain domain;
+  std::atomic<bool> in_region = false;
+  std::atomic<bool> reader_exited = false;
+  std::atomic<bool> synchronized = false;
+
+  std::thread reader{[&]() {
+    domain.enter();
+    in_region = true;
+
+    std::this_thread::sleep_for(50ms);
+
+    reader_exited = true;
+    domain.exit();
+  }};
+
+  while (!in_region)
+    std::this_thread::yield();
+
+  std::thread synchronizer{[&]() {
+    domain.synchronize();
+    REQUIRE(reader_exited);
+    synchronized = true;
+  }};
+
+  synchronizer.join();
+  reader.join();
+
+  REQUIRE(synchronized);
+}
+
+TEST_CASE("HazardPointerDomain Readers And Writers") {
+  constexpr int NumReaders = 8;
+  constexpr int NumUpdates = 20000;
+
+  {
+    sync_prim::reclamation::HazardPointerDomain domain;
+    std::atomic<Node *> shared{new Node{0}};
+    std::atomic<bool> quit = false;
+    std::atomic<bool> corrupted = false;
+    std::vector<std::thread> readers;
+
+    for (int i = 0; i < NumReaders; i++) {
+      readers.emplace_back([&]() {
+        sync_prim::reclamation::HazardPointerDomain::Holder hazards{domain};
+
+        while (!quit) {
+          Node *node = hazards.protect(0, shared);
+
+          if (node->magic != Node::LIVE)
+            corrupted = true;
+
+          hazards.clear(0);
+        }
+      });
+    }
+
+    std::thread writer{[&]() {
+      for (int i = 1; i <= NumUpdates; i++)
+        domain.retire(shared.exchange(new Node(i)));
+    }};
+
+    writer.join();
+    quit = true;
+
+    for (auto &reader : readers) {
+      reader.join();
+    }
+
+    REQUIRE(!corrupted);
+    REQUIRE(shared.load()->value == NumUpdates);
+
+    delete shared.load();
+  }
+
+  REQUIRE(Node::num_live == 0);
+}
+
+TEST_CASE("HazardPointerDomain Protected Objects Are Retained") {
+  sync_prim::reclamation::HazardPointerDomain domain;
+  std::atomic<Node *> shared{new Node{1}};
+  std::atomic<bool> is_protected = false;
+  std::atomic<bool> retired = false;
+
+  std::thread reader{[&]() {
+    sync_prim::reclamation::HazardPointerDomain::Holder hazards{domain};
+    Node *node = hazards.protect(1, shared);
+
+    is_protected = true;
+
+    while (!retired)
+      std::this_thread::yield();
+
+    REQUIRE(node->magic == Node::LIVE);
+    hazards.clear(1);
+  }};
+
+  while (!is_protected)
+    std::this_thread::yield();
+
+  std::thread{[&]() {
+    domain.retire(shared.exchange(nullptr));
+    domain.reclaim();
+
+    // Still protected by the reader.
+    REQUIRE(Node::num_live == 1);
+
+    retired = true;
+    reader.join();
+
+    domain.reclaim();
+    REQUIRE(Node::num_live == 0);
+  }}.join();
+}
+
+TEST_CASE("Rcu Readers And Updaters") {
+  constexpr int NumReaders = 8;
+  constexpr int NumUpdaters = 4;
+  constexpr int NumUpdates = 5000;
+
+  using namespace sync_prim::reclamation;
+
+  std::atomic<Node *> shared{new Node{0}};
+  std::atomic<bool> quit = false;
+  std::atomic<bool> corrupted = false;
+  std::vector<std::thread> readers;
+  std::vector<std::thread> updaters;
+
+  for (int i = 0; i < NumReaders; i++) {
+    readers.emplace_back([&]() {
+      while (!quit) {
+        rcu_read_lock();
+
+        if (shared.load()->magic != Node::LIVE)
+          corrupted = true;
+
+        rcu_read_unlock();
+      }
+    });
+  }
+
+  // Half the updaters wait for the grace period, the rest defer the free.
+  for (int i = 0; i < NumUpdaters; i++) {
+    updaters.emplace_back([&, i]() {
+      for (int j = 0; j < NumUpdates; j++) {
+        Node *old = shared.exchange(new Node(j));
+
+        if (i % 2 == 0 && j % 100 == 0) {
+          synchronize_rcu();
+          delete old;
+        } else {
+          RcuDomain::Instance.retire(old);
+        }
+      }
+    });
+  }
+
+  for (auto &updater : updaters) {
+    updater.join();
+  }
+
+  quit = true;
+
+  for (auto &reader : readers) {
+    reader.join();
+  }
+
+  rcu_barrier();
+
+  REQUIRE(!corrupted);
+  REQUIRE(Node::num_live == 1);
+
+  delete shared.load();
+}
+
+TEST_CASE("Rcu Synchronize Waits For Readers") {
+  using namespace sync_prim::reclamation;
+
+  std::atomic<bool> in_region = false;
+  std::atomic<bool> reader_exited = false;
+
+  std::thread reader{[&]() {
+    rcu_read_lock();
+    rcu_read_lock();
+    in_region = true;
+
+    std::this_thread::sleep_for(50ms);
+
+    rcu_read_unlock();
+    reader_exited = true;
+    rcu_read_unlock();
+  }};
+
+  while (!in_region)
+    std::this_thread::yield();
+
+  std::thread{[&]() {
+    synchronize_rcu();
+    REQUIRE(reader_exited);
+  }}.join();
+
+  reader.join();
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,422 @@
+#include "sync_prim/ParkingLot.h"
+#include "sync_prim/ShardedCounter.h"
+#include "sync_prim/ThreadRegistry.h"
+#include "sync_prim/ThreadSlots.h"
+#include "sync_prim/barrier.h"
+
+#include "doctest/doctest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+TEST_SUITE_BEGIN("ThreadRegistry");
+
+using sync_prim::ThreadRegistry;
+
+TEST_CASE("ThreadRegistry Lowest Free TID") {
+  constexpr int NumThreads =
+      std::min<int>(200, ThreadRegistry::MAX_THREADS / 2);
+
+  std::vector<ThreadRegistry::thread_id_t> tids(NumThreads);
+  std::vector<ThreadRegistry::thread_id_t> free_tids;
+  std::vector<std::thread> workers;
+  sync_prim::barrier registered{NumThreads + 1};
+  sync_prim::barrier unregister{NumThreads + 1};
+  // Other tests may leave behind registered threads (for eg: RCU's).
+  auto num_registered = ThreadRegistry::NumRegisteredThreads();
+  auto max_tid = ThreadRegistry::MaxThreadID();
+
+  for (ThreadRegistry::thread_id_t tid = 0; free_tids.size() < NumThreads;
+       tid++) {
+    if (!ThreadRegistry::IsRegistered(tid))
+      free_tids.push_back(tid);
+  }
+
+  for (int i = 0; i < NumThreads; i++) {
+    workers.emplace_back([&, i]() {
+      REQUIRE(ThreadRegistry::RegisterThread());
+      REQUIRE(!ThreadRegistry::RegisterThread());
+
+      tids[i] = ThreadRegistry::ThreadID();
+
+      registered.arrive_and_wait();
+      unregister.arrive_and_wait();
+
+      ThreadRegistry::UnregisterThread();
+    });
+  }
+
+  registered.arrive_and_wait();
+
+  // Concurrently registered threads get the lowest `NumThreads` free tids.
+  std::sort(tids.begin(), tids.end());
+
+  REQUIRE(tids == free_tids);
+  REQUIRE(ThreadRegistry::NumRegisteredThreads() ==
+          num_registered + NumThreads);
+  REQUIRE(ThreadRegistry::MaxThreadID() ==
+          (max_tid == ThreadRegistry::INVALID_THREADID
+               ? free_tids.back()
+               : std::max(free_tids.back(), max_tid)));
+
+  unregister.arrive_and_wait();
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  REQUIRE(ThreadRegistry::NumRegisteredThreads() == num_registered);
+  REQUIRE(ThreadRegistry::MaxThreadID() == max_tid);
+
+  // Freed tids are reused, lowest first.
+  std::thread{[&]() {
+    REQUIRE(ThreadRegistry::RegisterThread());
+    REQUIRE(ThreadRegistry::ThreadID() == free_tids.front());
+  }}.join();
+}
+
+TEST_CASE("ThreadRegistry Concurrent Unregistration") {
+  constexpr int NumThreads = 8;
+  constexpr int NumRounds = 200;
+
+  auto max_tid = ThreadRegistry::MaxThreadID();
+
+  // Threads exiting together each see the others' tids as used, while
+  // lowering the max.
+  for (int round = 0; round < NumRounds; round++) {
+    std::vector<std::thread> workers;
+    sync_prim::barrier registered{NumThreads};
+
+    for (int i = 0; i < NumThreads; i++) {
+      workers.emplace_back([&]() {
+        ThreadRegistry::ThreadID();
+        registered.arrive_and_wait();
+      });
+    }
+
+    for (auto &worker : workers) {
+      worker.join();
+    }
+
+    REQUIRE(ThreadRegistry::MaxThreadID() == max_tid);
+  }
+}
+
+TEST_CASE("ThreadRegistry Automatic Registration") {
+  auto num_registered = ThreadRegistry::NumRegisteredThreads();
+  auto max_tid = ThreadRegistry::MaxThreadID();
+
+  std::thread{[&]() {
+    // Registered on first use, and unregistered at exit.
+    auto tid = ThreadRegistry::ThreadID();
+
+    REQUIRE(tid != ThreadRegistry::INVALID_THREADID);
+    REQUIRE(ThreadRegistry::ThreadID() == tid);
+    REQUIRE(ThreadRegistry::IsRegistered(tid));
+    REQUIRE(ThreadRegistry::NumRegisteredThreads() == num_registered + 1);
+  }}.join();
+
+  REQUIRE(ThreadRegistry::NumRegisteredThreads() == num_registered);
+
+  std::thread{[]() { REQUIRE(ThreadRegistry::RegisterThread()); }}.join();
+
+  REQUIRE(ThreadRegistry::NumRegisteredThreads() == num_registered);
+  REQUIRE(ThreadRegistry::MaxThreadID() == max_tid);
+}
+
+// Uses a tid from its destructor, after the thread's registration guard is
+// destroyed.
+struct LateTidUser {
+  ~LateTidUser() { tid = ThreadRegistry::ThreadID(); }
+
+  static inline std::atomic<ThreadRegistry::thread_id_t> tid =
+      ThreadRegistry::INVALID_THREADID;
+};
+
+TEST_CASE("ThreadRegistry Registration From TLS Destructors") {
+  auto num_registered = ThreadRegistry::NumRegisteredThreads();
+
+  std::thread{[]() {
+    // Constructed before the guard, so destroyed after it.
+    static thread_local LateTidUser late_tid_user;
+
+    (void)late_tid_user;
+    ThreadRegistry::ThreadID();
+  }}.join();
+
+  // Registered again, and unregistered, instead of leaking the tid.
+  REQUIRE(LateTidUser::tid != ThreadRegistry::INVALID_THREADID);
+  REQUIRE(!ThreadRegistry::IsRegistered(LateTidUser::tid));
+  REQUIRE(ThreadRegistry::NumRegisteredThreads() == num_registered);
+}
+
+TEST_CASE("ThreadRegistry Topology") {
+  constexpr int NumThreads = 16;
+
+  std::vector<std::thread> workers;
+  std::vector<ThreadRegistry::thread_id_t> tids(NumThreads);
+  sync_prim::barrier registered{NumThreads + 1};
+  sync_prim::barrier unregister{NumThreads + 1};
+
+  REQUIRE(ThreadRegistry::NumCPUs() >= 1);
+  REQUIRE(ThreadRegistry::NumNodes() >= 1);
+
+  for (std::uint32_t cpu = 0; cpu < ThreadRegistry::NumCPUs(); cpu++)
+    REQUIRE(ThreadRegistry::NodeOfCPU(cpu) < ThreadRegistry::NumNodes());
+
+  for (int i = 0; i < NumThreads; i++) {
+    workers.emplace_back([&, i]() {
+      tids[i] = ThreadRegistry::ThreadID();
+
+      REQUIRE(ThreadRegistry::CurrentCPU() < ThreadRegistry::NumCPUs());
+      REQUIRE(ThreadRegistry::CurrentNode() < ThreadRegistry::NumNodes());
+
+      registered.arrive_and_wait();
+      unregister.arrive_and_wait();
+    });
+  }
+
+  registered.arrive_and_wait();
+
+  // Every thread is listed under the node, it was last seen on.
+  std::vector<ThreadRegistry::thread_id_t> node_tids;
+  int num_listed = 0;
+
+  for (std::uint32_t node = 0; node < ThreadRegistry::NumNodes(); node++) {
+    ThreadRegistry::ThreadsOnNode(node, node_tids);
+
+    for (auto tid : tids) {
+      auto listed = std::find(node_tids.begin(), node_tids.end(), tid) !=
+                    node_tids.end();
+
+      REQUIRE(listed == (ThreadRegistry::Node(tid) == node));
+      num_listed += listed;
+    }
+  }
+
+  REQUIRE(num_listed == NumThreads);
+
+  unregister.arrive_and_wait();
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  ThreadRegistry::ThreadsOnNode(ThreadRegistry::Node(tids[0]), node_tids);
+  REQUIRE(std::find(node_tids.begin(), node_tids.end(), tids[0]) ==
+          node_tids.end());
+}
+
+TEST_CASE("ThreadRegistry CPU Refresh On Park") {
+  cpu_set_t cpus;
+  int cpu = CPU_SETSIZE - 1;
+
+  REQUIRE(sched_getaffinity(0, sizeof(cpus), &cpus) == 0);
+
+  while (!CPU_ISSET(cpu, &cpus))
+    cpu--;
+
+  std::thread{[&]() {
+    auto tid = ThreadRegistry::ThreadID();
+    cpu_set_t cpu_set;
+
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    REQUIRE(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+                                   &cpu_set) == 0);
+
+    // Moved to `cpu` after registering, seen by the first CurrentCPU() once
+    // the thread parks, instead of up to CPU_REFRESH_INTERVAL calls later.
+    sync_prim::ParkingLot<> parkinglot;
+    int key;
+    auto timeout = std::chrono::milliseconds(1);
+
+    REQUIRE(parkinglot.park_for(
+                &key, folly::Unit{}, []() { return true; }, []() {},
+                timeout) == sync_prim::ParkResult::Timeout);
+    REQUIRE(ThreadRegistry::CurrentCPU() == static_cast<std::uint32_t>(cpu));
+    REQUIRE(ThreadRegistry::CPU(tid) == static_cast<std::uint32_t>(cpu));
+    REQUIRE(ThreadRegistry::Node(tid) == ThreadRegistry::NodeOfCPU(cpu));
+  }}.join();
+}
+
+TEST_CASE("ThreadRegistry Tid Recycling") {
+  cpu_set_t cpus;
+  int cpu = 0;
+
+  REQUIRE(sched_getaffinity(0, sizeof(cpus), &cpus) == 0);
+
+  while (!CPU_ISSET(cpu, &cpus))
+    cpu++;
+
+  // Registers on `cpu`, and returns the tid.
+  auto register_on_cpu = [&]() {
+    cpu_set_t cpu_set;
+
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    REQUIRE(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+                                   &cpu_set) == 0);
+    return ThreadRegistry::ThreadID();
+  };
+
+  ThreadRegistry::thread_id_t low_tid, recycled_tid, tid;
+  sync_prim::barrier low_registered{4}, recycled_registered{3};
+  sync_prim::barrier high_registered{2};
+  sync_prim::barrier low_exit{2}, recycled_exit{2}, high_exit{2};
+
+  ThreadRegistry::SetTidRecycling(true);
+
+  // `low` frees a lower tid, than the one cached by `recycled` on `cpu`, and
+  // `high` keeps MaxThreadID() above both.
+  std::thread low{[&]() {
+    low_tid = ThreadRegistry::ThreadID();
+    low_registered.arrive_and_wait();
+    low_exit.arrive_and_wait();
+  }};
+  std::thread recycled{[&]() {
+    low_registered.arrive_and_wait();
+    recycled_tid = register_on_cpu();
+    recycled_registered.arrive_and_wait();
+    recycled_exit.arrive_and_wait();
+  }};
+  std::thread high{[&]() {
+    low_registered.arrive_and_wait();
+    recycled_registered.arrive_and_wait();
+    ThreadRegistry::ThreadID();
+    high_registered.arrive_and_wait();
+    high_exit.arrive_and_wait();
+  }};
+
+  low_registered.arrive_and_wait();
+  recycled_registered.arrive_and_wait();
+  high_registered.arrive_and_wait();
+
+  low_exit.arrive_and_wait();
+  low.join();
+  recycled_exit.arrive_and_wait();
+  recycled.join();
+
+  REQUIRE(low_tid < recycled_tid);
+
+  std::thread{[&]() { tid = register_on_cpu(); }}.join();
+  REQUIRE(tid == recycled_tid);
+
+  // Without recycling, the lowest free tid is handed out.
+  ThreadRegistry::SetTidRecycling(false);
+
+  std::thread{[&]() { tid = register_on_cpu(); }}.join();
+  REQUIRE(tid <= low_tid);
+
+  high_exit.arrive_and_wait();
+  high.join();
+}
+
+TEST_CASE("ThreadSlots") {
+  constexpr int NumThreads = 100;
+
+  sync_prim::ThreadSlots<int> slots;
+  std::vector<std::thread> workers;
+  sync_prim::barrier filled{NumThreads + 1};
+  sync_prim::barrier unregister{NumThreads + 1};
+
+  for (int i = 0; i < NumThreads; i++) {
+    workers.emplace_back([&, i]() {
+      REQUIRE(slots.local() == 0);
+      slots.local() = i + 1;
+
+      filled.arrive_and_wait();
+      unregister.arrive_and_wait();
+    });
+  }
+
+  filled.arrive_and_wait();
+
+  int num_slots = 0;
+  int sum = 0;
+
+  slots.for_each([&](ThreadRegistry::thread_id_t tid, int value) {
+    REQUIRE(slots[tid] == value);
+    num_slots++;
+    sum += value;
+  });
+
+  REQUIRE(num_slots == NumThreads);
+  REQUIRE(sum == NumThreads * (NumThreads + 1) / 2);
+
+  unregister.arrive_and_wait();
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  // Slots of exited threads are skipped, and reset for the next owner.
+  slots.for_each([&](ThreadRegistry::thread_id_t, int) { REQUIRE(false); });
+
+  std::thread{[&]() { REQUIRE(slots.local() == 0); }}.join();
+}
+
+TEST_CASE("ShardedCounter") {
+  constexpr int NumThreads = 32;
+  constexpr int NumIncrements = 10000;
+
+  sync_prim::ShardedCounter counter;
+  std::vector<std::thread> workers;
+
+  for (int i = 0; i < NumThreads; i++) {
+    workers.emplace_back([&]() {
+      for (int j = 0; j < NumIncrements; j++)
+        counter.add();
+    });
+  }
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  // Counts of exited threads are retained.
+  REQUIRE(counter.load() == NumThreads * NumIncrements);
+
+  std::thread{[&]() { counter.add(5); }}.join();
+  REQUIRE(counter.load() == NumThreads * NumIncrements + 5);
+}
+
+TEST_CASE("ShardedHistogram") {
+  constexpr int NumThreads = 8;
+
+  sync_prim::ShardedHistogram histogram;
+  std::vector<std::thread> workers;
+
+  REQUIRE(histogram.snapshot().percentile(50) == 0);
+
+  // Every thread records 1..100
+  for (int i = 0; i < NumThreads; i++) {
+    workers.emplace_back([&]() {
+      for (std::uint64_t value = 1; value <= 100; value++)
+        histogram.record(value);
+    });
+  }
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  auto snapshot = histogram.snapshot();
+
+  REQUIRE(snapshot.count == NumThreads * 100);
+  REQUIRE(snapshot.sum == NumThreads * 5050);
+  REQUIRE(snapshot.mean() == 50.5);
+  REQUIRE(snapshot.buckets[sync_prim::ShardedHistogram::bucket(1)] ==
+          NumThreads);
+  // 50 is in [32, 64), and 100 in [64, 128)
+  REQUIRE(snapshot.percentile(50) == 63);
+  REQUIRE(snapshot.percentile(100) == 127);
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,278 @@
+#include "sync_prim/Trace.h"
+#include "sync_prim/TraceLog.h"
+#include "sync_prim/barrier.h"
+
+#include "doctest/doctest.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_SUITE_BEGIN("TraceLog");
+
+using sync_prim::TraceLog;
+
+TEST_CASE("TraceLog Merge") {
+  constexpr int NumThreads = 8;
+  constexpr int NumEvents = 1000;
+
+  TraceLog log;
+  std::vector<std::thread> workers;
+  sync_prim::barrier start{NumThreads};
+
+  for (int i = 0; i < NumThreads; i++) {
+    workers.emplace_back([&, i]() {
+      start.arrive_and_wait();
+
+      for (int j = 0; j < NumEvents; j++)
+        log.log("[%d] %d %d", i, j);
+    });
+  }
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  // Events are merged in time order, with every thread's events in order.
+  std::map<std::uintptr_t, std::uintptr_t> next_event;
+  std::uint64_t last_tsc = 0;
+  int num_events = 0;
+
+  for (const auto &evt : log) {
+    REQUIRE(evt.tsc >= last_tsc);
+    REQUIRE(evt.param2 == next_event[evt.param1]++);
+
+    last_tsc = evt.tsc;
+    num_events++;
+  }
+
+  REQUIRE(num_events == NumThreads * NumEvents);
+}
+
+TEST_CASE("TraceLog Wrap Around") {
+  constexpr int NumEvents = TraceLog::EventsPerThread + 100;
+
+  TraceLog log;
+
+  std::thread{[&]() {
+    for (int i = 0; i < NumEvents; i++)
+      log.log("[%d] %d", i, 0);
+  }}.join();
+
+  // Only the most recent events are kept.
+  std::uintptr_t expected = NumEvents - TraceLog::EventsPerThread;
+
+  for (const auto &evt : log)
+    REQUIRE(evt.param1 == expected++);
+
+  REQUIRE(expected == static_cast<std::uintptr_t>(NumEvents));
+}
+
+TEST_CASE("TraceLog Timestamps") {
+  TraceLog log;
+
+  log.log("[%d] start", 0, 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  log.log("[%d] end", 0, 0);
+
+  std::vector<std::uint64_t> tscs;
+
+  for (const auto &evt : log)
+    tscs.push_back(evt.tsc);
+
+  REQUIRE(tscs.size() == 2);
+
+  auto elapsed_ns = TraceLog::toNanoseconds(tscs[1] - tscs[0]);
+
+  REQUIRE(elapsed_ns >= 15e6);
+  REQUIRE(elapsed_ns < 10e9);
+}
+
+TEST_CASE("TraceLog Chrome Trace") {
+  namespace trace = sync_prim::trace;
+
+  TraceLog log;
+  int lock;
+  auto lock_addr = reinterpret_cast<std::uintptr_t>(&lock);
+
+  // A waits for B to release the lock.
+  std::thread{[&]() {
+    log.log(trace::LOCK_ACQUIRED, lock_addr, 0);
+    log.log(trace::CONTENDED, lock_addr, 0);
+    log.log(trace::LOCK_RELEASED, lock_addr, 0);
+  }}.join();
+  std::thread{[&]() {
+    log.log(trace::PARK, lock_addr, 0);
+    log.log(trace::UNPARKED, lock_addr, 0);
+    log.log(trace::LOCK_ACQUIRED, lock_addr, 0);
+    log.log("[%d] \"quoted\"", 0, 0);
+  }}.join();
+
+  auto path = (std::filesystem::temp_directory_path() / "testTraceLog.json")
+                  .string();
+
+  REQUIRE(log.dumpChromeTrace(path.c_str()));
+
+  std::stringstream json;
+  json << std::ifstream{path}.rdbuf();
+  std::remove(path.c_str());
+
+  auto count = [&](const std::string &str) {
+    int n = 0;
+
+    for (auto pos = json.str().find(str); pos != std::string::npos;
+         pos = json.str().find(str, pos + 1))
+      n++;
+
+    return n;
+  };
+
+  char lock_name[32];
+  std::snprintf(lock_name, sizeof(lock_name), "0x%" PRIxPTR, lock_addr);
+
+  REQUIRE(json.str().rfind("{\"traceEvents\":[", 0) == 0);
+  // Both holds (the 2nd, cut off at the end of the log), and the wait.
+  REQUIRE(count("\"ph\":\"X\"") == 3);
+  REQUIRE(count(std::string{"\"name\":\"hold "} + lock_name) == 2);
+  REQUIRE(count(std::string{"\"name\":\"wait "} + lock_name) == 1);
+  REQUIRE(count("\"ph\":\"i\"") == 2);
+  REQUIRE(count("\"name\":\"\\\"quoted\\\"\"") == 1);
+  REQUIRE(count(std::string{"\"name\":\"contended "} + lock_name) == 1);
+}
+
+TEST_CASE("TraceLog Dump Errors") {
+  TraceLog log;
+  auto path = (std::filesystem::temp_directory_path() / "testTraceLog.none" /
+               "testTraceLog.log")
+                  .string();
+
+  log.log("[%d] %d", 0, 0);
+
+  REQUIRE(!log.dumpEntireLog(path.c_str()));
+  REQUIRE(!log.dumpChromeTrace(path.c_str()));
+}
+
+TEST_CASE("TraceLog Mapped File") {
+  using namespace sync_prim::trace_file;
+
+  constexpr std::uint32_t NumRings = 256;
+  constexpr int NumEvents = 200;
+
+  TraceLog log;
+  sync_prim::ThreadRegistry::thread_id_t tid;
+  auto path = (std::filesystem::temp_directory_path() / "testTraceLog.trace")
+                  .string();
+
+  REQUIRE(log.mapFile(path.c_str(), NumRings, 100));
+  REQUIRE(!log.mapFile(path.c_str(), NumRings, 100));
+
+  std::thread{[&]() {
+    tid = sync_prim::ThreadRegistry::ThreadID();
+
+    for (int i = 0; i < NumEvents; i++)
+      log.log("[%d] %d", i, 0);
+  }}.join();
+
+  REQUIRE(tid < NumRings);
+
+  // Rings are rounded up to 128 events, and only the most recent are kept.
+  std::uintptr_t expected = NumEvents - 128;
+
+  for (const auto &evt : log)
+    REQUIRE(evt.param1 == expected++);
+
+  REQUIRE(expected == static_cast<std::uintptr_t>(NumEvents));
+
+  // The file describes itself, and has the events and their format.
+  std::ifstream in{path, std::ios::binary};
+  std::string file{std::istreambuf_iterator<char>(in), {}};
+  std::remove(path.c_str());
+
+  REQUIRE(file.size() >= sizeof(Header));
+
+  auto *header = reinterpret_cast<const Header *>(file.data());
+
+  REQUIRE(std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0);
+  REQUIRE(header->numRings == NumRings);
+  REQUIRE(header->eventsPerRing == 128);
+  REQUIRE(file.size() >= header->ringsOffset + NumRings * header->ringSize);
+
+  auto *ring = file.data() + header->ringsOffset + tid * header->ringSize;
+  auto *newest = ring + header->eventsOffset +
+                 (NumEvents - 1) % 128 * header->eventSize;
+  std::uintptr_t param1;
+  int event_tid;
+
+  REQUIRE(reinterpret_cast<const RingHeader *>(ring)->count == NumEvents);
+  std::memcpy(&param1, newest + header->param1Offset, sizeof(param1));
+  std::memcpy(&event_tid, newest + header->tidOffset, sizeof(event_tid));
+  REQUIRE(param1 == NumEvents - 1);
+  REQUIRE(event_tid == static_cast<int>(tid));
+
+  auto *formats =
+      reinterpret_cast<const Format *>(file.data() + header->formatsOffset);
+  int num_formats = 0;
+
+  for (std::uint32_t i = 0; i < header->numFormats; i++) {
+    if (formats[i].ready) {
+      REQUIRE(std::string{formats[i].text} == "[%d] %d");
+      num_formats++;
+    }
+  }
+
+  REQUIRE(num_formats == 1);
+}
+
+TEST_CASE("TraceLog Mapped File Formats") {
+  using namespace sync_prim::trace_file;
+
+  // Enough formats for some of them to collide in the format table.
+  constexpr int NumFormats = 64;
+
+  static char fmts[NumFormats][16];
+  TraceLog log;
+  auto path = (std::filesystem::temp_directory_path() / "testTraceLog.trace")
+                  .string();
+
+  REQUIRE(log.mapFile(path.c_str(), 256, 100));
+
+  for (int i = 0; i < NumFormats; i++)
+    std::snprintf(fmts[i], sizeof(fmts[i]), "[%%d] fmt %d", i);
+
+  std::thread{[&]() {
+    for (int round = 0; round < 2; round++) {
+      for (auto &fmt : fmts)
+        log.log(fmt, 0, 0);
+    }
+  }}.join();
+
+  std::ifstream in{path, std::ios::binary};
+  std::string file{std::istreambuf_iterator<char>(in), {}};
+  std::remove(path.c_str());
+
+  auto *header = reinterpret_cast<const Header *>(file.data());
+  auto *formats =
+      reinterpret_cast<const Format *>(file.data() + header->formatsOffset);
+  std::map<std::string, int> texts;
+
+  for (std::uint32_t i = 0; i < header->numFormats; i++) {
+    if (formats[i].ready)
+      texts[formats[i].text]++;
+  }
+
+  // Every format is copied once, however far it's from its first slot.
+  REQUIRE(texts.size() == NumFormats);
+
+  for (const auto &[text, count] : texts)
+    REQUIRE(count == 1);
+}
+
+TEST_SUITE_END();